@@ -62,7 +62,10 @@ static void usage(void)
 	     "Debug:\n"
 	     "These commands work on offline, unmounted filesystems\n"
 	     "  dump             Dump filesystem metadata to a qcow2 image\n"
-	     "  list             List filesystem metadata in textual form\n");
+	     "  list             List filesystem metadata in textual form\n"
+	     "\n"
+	     "Benchmark:\n"
+	     "  bench            Benchmark checksum, encryption and compression\n");
 }
 
 static char *full_cmd;
@@ -160,6 +163,9 @@ int main(int argc, char *argv[])
 	if (!strcmp(cmd, "list"))
 		return cmd_list(argc, argv);
 
+	if (!strcmp(cmd, "bench"))
+		return cmd_bench(argc, argv);
+
 	usage();
 	return 0;
 }
@@ -107,7 +107,7 @@ static const uint32_t crc32c_tab[] = {
  * Steps through buffer one byte at at time, calculates reflected
  * crc using table.
  */
-uint32_t crc32c(uint32_t crc, const void *buf, size_t size)
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t size)
 {
 	const uint8_t *p = buf;
 
@@ -117,6 +117,200 @@ uint32_t crc32c(uint32_t crc, const void *buf, size_t size)
 	return crc;
 }
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#include <string.h>
+
+/*
+ * SSE4.2 crc32c, after Mark Adler's crc32c.c:
+ *
+ * The crc32 instruction has a latency of three cycles but a throughput of one
+ * per cycle, so we run three independent crcs over three adjacent chunks of
+ * the buffer and then combine them: since the crc (without pre/post
+ * inversion) is linear, crc(A + B) = shift(crc(A), len(B)) ^ crc(B) where
+ * shift() is the crc of len(B) zero bytes - which, for the two fixed chunk
+ * sizes we use, is precomputed into four byte-indexed tables.
+ */
+#define CRC32C_LONG	8192
+#define CRC32C_SHORT	256
+
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+
+static inline uint64_t load64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_zeros_hw(uint32_t crc, size_t len)
+{
+	uint64_t crc0 = crc;
+
+	for (; len >= 8; len -= 8)
+		crc0 = _mm_crc32_u64(crc0, 0);
+	for (crc = crc0; len; len--)
+		crc = _mm_crc32_u8(crc, 0);
+
+	return crc;
+}
+
+/* Tables that apply the crc of @len zero bytes to a crc, a byte at a time: */
+__attribute__((target("sse4.2")))
+static void crc32c_zeros(uint32_t zeros[4][256], size_t len)
+{
+	uint32_t basis[32];
+	unsigned i, j;
+
+	for (i = 0; i < 32; i++)
+		basis[i] = crc32c_zeros_hw(1U << i, len);
+
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < 256; j++) {
+			uint32_t v = 0;
+			unsigned bit;
+
+			for (bit = 0; bit < 8; bit++)
+				if (j & (1U << bit))
+					v ^= basis[i * 8 + bit];
+			zeros[i][j] = v;
+		}
+}
+
+static inline uint32_t crc32c_shift(uint32_t zeros[4][256], uint32_t crc)
+{
+	return	zeros[0][crc & 0xff] ^
+		zeros[1][(crc >> 8) & 0xff] ^
+		zeros[2][(crc >> 16) & 0xff] ^
+		zeros[3][crc >> 24];
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t size)
+{
+	const uint8_t *p = buf;
+	uint64_t crc0 = crc, crc1, crc2;
+	const uint8_t *end;
+
+	/* align to 8 bytes: */
+	while (size && ((uintptr_t) p & 7)) {
+		crc0 = _mm_crc32_u8(crc0, *p++);
+		size--;
+	}
+
+	while (size >= CRC32C_LONG * 3) {
+		crc1 = crc2 = 0;
+		end = p + CRC32C_LONG;
+		do {
+			crc0 = _mm_crc32_u64(crc0, load64(p));
+			crc1 = _mm_crc32_u64(crc1, load64(p + CRC32C_LONG));
+			crc2 = _mm_crc32_u64(crc2, load64(p + CRC32C_LONG * 2));
+			p += 8;
+		} while (p < end);
+
+		crc0 = crc32c_shift(crc32c_long, crc0) ^ crc1;
+		crc0 = crc32c_shift(crc32c_long, crc0) ^ crc2;
+		p += CRC32C_LONG * 2;
+		size -= CRC32C_LONG * 3;
+	}
+
+	while (size >= CRC32C_SHORT * 3) {
+		crc1 = crc2 = 0;
+		end = p + CRC32C_SHORT;
+		do {
+			crc0 = _mm_crc32_u64(crc0, load64(p));
+			crc1 = _mm_crc32_u64(crc1, load64(p + CRC32C_SHORT));
+			crc2 = _mm_crc32_u64(crc2, load64(p + CRC32C_SHORT * 2));
+			p += 8;
+		} while (p < end);
+
+		crc0 = crc32c_shift(crc32c_short, crc0) ^ crc1;
+		crc0 = crc32c_shift(crc32c_short, crc0) ^ crc2;
+		p += CRC32C_SHORT * 2;
+		size -= CRC32C_SHORT * 3;
+	}
+
+	for (; size >= 8; size -= 8, p += 8)
+		crc0 = _mm_crc32_u64(crc0, load64(p));
+
+	for (crc = crc0; size; size--)
+		crc = _mm_crc32_u8(crc, *p++);
+
+	return crc;
+}
+#endif
+
+static uint32_t crc32c_detect(uint32_t crc, const void *buf, size_t size);
+
+static uint32_t (*crc32c_impl)(uint32_t, const void *, size_t) = crc32c_detect;
+
+/*
+ * First call picks the implementation: racing callers just redo the same
+ * work, and the tables are written before the pointer is published.
+ */
+static uint32_t crc32c_detect(uint32_t crc, const void *buf, size_t size)
+{
+	uint32_t (*impl)(uint32_t, const void *, size_t) = crc32c_sw;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		crc32c_zeros(crc32c_long, CRC32C_LONG);
+		crc32c_zeros(crc32c_short, CRC32C_SHORT);
+		impl = crc32c_hw;
+	}
+#endif
+	__atomic_store_n(&crc32c_impl, impl, __ATOMIC_RELEASE);
+
+	return impl(crc, buf, size);
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t size)
+{
+	return __atomic_load_n(&crc32c_impl, __ATOMIC_ACQUIRE)(crc, buf, size);
+}
+
+/*
+ * Multiplication mod the crc32c polynomial, reflected: bit 31 is x^0, bit 0 is
+ * x^31.
+ */
+static uint32_t crc32c_mulmod(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1U << 31, p = 0;
+
+	while (1) {
+		if (a & m) {
+			p ^= b;
+			if (!(a & (m - 1)))
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ 0x82F63B78 : b >> 1;
+	}
+
+	return p;
+}
+
+/*
+ * Feeding n zero bytes through the crc register multiplies it by x^(8n) mod P,
+ * so combining is crc1 * x^(8 * size2) ^ crc2:
+ */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, size_t size2)
+{
+	uint32_t xn = 1U << 31, x8 = 1U << 23;
+
+	for (; size2; size2 >>= 1) {
+		if (size2 & 1)
+			xn = crc32c_mulmod(xn, x8);
+		x8 = crc32c_mulmod(x8, x8);
+	}
+
+	return crc32c_mulmod(xn, crc1) ^ crc2;
+}
+
 const uint32_t *crc32c_table(void)
 {
 	return crc32c_tab;
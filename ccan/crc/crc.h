@@ -45,6 +45,28 @@
  */
 uint32_t crc32c(uint32_t start_crc, const void *buf, size_t size);
 
+/**
+ * crc32c_sw - portable crc32c
+ * @start_crc: the initial crc (usually 0)
+ * @buf: pointer to bytes
+ * @size: length of buffer
+ *
+ * crc32c() uses the SSE4.2 crc32 instruction when the cpu has it, and falls
+ * back to this otherwise; the results are identical.
+ */
+uint32_t crc32c_sw(uint32_t start_crc, const void *buf, size_t size);
+
+/**
+ * crc32c_combine - crc32c of two buffers, from the crc32c of each
+ * @crc1: crc32c of the first buffer, from whatever start crc
+ * @crc2: crc32c of the second buffer, with a start crc of 0
+ * @size2: length of the second buffer
+ *
+ * Returns what crc32c(@crc1, buf2, @size2) would have: so buffers can be
+ * checksummed separately (in parallel, say) and the results combined.
+ */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, size_t size2);
+
 /**
  * crc32c_table - Get the Castagnoli CRC table
  *
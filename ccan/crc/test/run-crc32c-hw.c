@@ -0,0 +1,44 @@
+#include <ccan/crc/crc.h>
+#include <ccan/tap/tap.h>
+#include <stdlib.h>
+
+#define BUF_SIZE	(3 * 8192 * 2 + 3 * 256 * 2 + 64)
+
+/* crc32c() may use the SSE4.2 path: it must agree with crc32c_sw(). */
+int main(int argc, char *argv[])
+{
+	unsigned char *buf = malloc(BUF_SIZE);
+	unsigned int i, bad = 0;
+
+	plan_tests(3);
+
+	srandom(1);
+	for (i = 0; i < BUF_SIZE; i++)
+		buf[i] = random();
+
+	/* Every small length and alignment: */
+	for (i = 0; i < 64 * 64; i++)
+		if (crc32c(i, buf + i % 64, i / 64) !=
+		    crc32c_sw(i, buf + i % 64, i / 64))
+			bad++;
+	ok1(!bad);
+
+	/* Lengths spanning the short and long three way split: */
+	for (i = 0; i < 1000; i++) {
+		size_t off = random() % 64;
+		size_t len = random() % (BUF_SIZE - 64);
+		uint32_t crc = random();
+
+		if (crc32c(crc, buf + off, len) !=
+		    crc32c_sw(crc, buf + off, len))
+			bad++;
+	}
+	ok1(!bad);
+
+	/* In two parts: */
+	ok1(crc32c(crc32c(0, buf, 12345), buf + 12345, BUF_SIZE - 12345) ==
+	    crc32c_sw(0, buf, BUF_SIZE));
+
+	free(buf);
+	return exit_status();
+}
@@ -0,0 +1,479 @@
+/*
+ * Microbenchmarks for the data path: checksums, encryption, compression
+ *
+ * GPLv2
+ */
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/bio.h>
+#include <linux/crypto.h>
+#include <linux/random.h>
+#include <crypto/hash.h>
+
+#include "cmds.h"
+#include "libbcache.h"
+
+#include "checksum.h"
+#include "compress.h"
+#include "io_types.h"
+#include "opts.h"
+#include "super-io.h"
+#include "util.h"
+
+static void usage(void)
+{
+	puts("bcache bench - benchmark checksum, encryption and compression\n"
+	     "Usage: bcache bench [OPTION]...\n"
+	     "\n"
+	     "Options:\n"
+	     "  -s, --sizes=size[,size]...   Buffer sizes, powers of two from 512\n"
+	     "                               to 16M, default 4k,64k,1M\n"
+	     "  -j, --threads=#[,#]...       Thread counts, default 1 and the number of cpus\n"
+	     "  -t, --time=seconds           How long to run each test for, default 1\n"
+	     "  -o, --ops=op[,op]...         Only run some of checksum, encrypt,\n"
+	     "                               compress, decompress\n"
+	     "      --zstd_level=#           zstd compression level (1-22), default 3\n"
+	     "  -h, --help                   Display this help and exit\n"
+	     "\n"
+	     "Output is one line per test, tab separated:\n"
+	     "  op type size threads MB/s ratio\n"
+	     "where ratio is the compression ratio, or - for other ops.\n"
+	     "Compression works on at most one extent at a time, so sizes\n"
+	     "bigger than that are skipped for compress and decompress.\n"
+	     "gzip allocates a workspace on every call, so its rows include\n"
+	     "that allocation; when it fails, threads share one workspace\n"
+	     "behind a lock, and multi-threaded rows measure contention.\n"
+	     "\n"
+	     "Report bugs to <linux-bcache@vger.kernel.org>");
+}
+
+enum bench_op {
+	BENCH_CHECKSUM,
+	BENCH_ENCRYPT,
+	BENCH_COMPRESS,
+	BENCH_DECOMPRESS,
+	BENCH_NR,
+};
+
+static const char * const bench_ops[] = {
+	"checksum",
+	"encrypt",
+	"compress",
+	"decompress",
+	NULL
+};
+
+static const char * const bench_csum_types[] = {
+	[BCH_CSUM_NONE]				= "none",
+	[BCH_CSUM_CRC32C]			= "crc32c",
+	[BCH_CSUM_CRC64]			= "crc64",
+	[BCH_CSUM_CHACHA20_POLY1305_80]		= "chacha20_poly1305_80",
+	[BCH_CSUM_CHACHA20_POLY1305_128]	= "chacha20_poly1305_128",
+};
+
+struct bench_buf {
+	void			*data;
+	struct bio		*bio;
+};
+
+struct bench_thread {
+	pthread_t		thread;
+	struct bench		*b;
+	struct write_point	wp;
+
+	struct bench_buf	src;
+	struct bench_buf	dst;
+	struct bench_buf	out;
+
+	struct bch_extent_crc128 crc;
+
+	u64			bytes;
+	u64			ns;
+};
+
+struct bench {
+	struct bch_fs		*c;
+	enum bench_op		op;
+	unsigned		type;
+	size_t			size;
+	u64			duration_ns;
+	pthread_barrier_t	start;
+};
+
+static u64 bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Something like text, so compression has something to do - from a fixed seed,
+ * so runs are comparable:
+ */
+static void bench_fill(void *buf, size_t size)
+{
+	static const char * const words[] = {
+		"the ", "of ", "bucket ", "extent ", "btree ", "node ",
+		"journal ", "key ", "and ", "a ", "to ", "in ", "is ",
+		"checksum ", "compressed ", "data ", "write ", "read ",
+		"allocator ", "superblock\n", "0x1f3a ", "inode 4096 ",
+	};
+	unsigned seed = 1;
+	char *p = buf, *end = buf + size;
+
+	while (p < end) {
+		const char *w = words[rand_r(&seed) % ARRAY_SIZE(words)];
+		size_t len = min_t(size_t, strlen(w), end - p);
+
+		memcpy(p, w, len);
+		p += len;
+	}
+}
+
+static void bench_buf_alloc(struct bench_buf *buf, size_t size)
+{
+	buf->data = aligned_alloc(PAGE_SIZE, round_up(size, PAGE_SIZE));
+	if (!buf->data)
+		die("insufficient memory");
+
+	buf->bio = bio_kmalloc(GFP_KERNEL, DIV_ROUND_UP(size, PAGE_SIZE));
+	if (!buf->bio)
+		die("insufficient memory");
+
+	buf->bio->bi_iter.bi_size = size;
+	bch_bio_map(buf->bio, buf->data);
+}
+
+static void bench_buf_free(struct bench_buf *buf)
+{
+	bio_put(buf->bio);
+	free(buf->data);
+}
+
+static void bench_bio_reset(struct bench_buf *buf, size_t size)
+{
+	buf->bio->bi_iter = (struct bvec_iter) { .bi_size = size };
+}
+
+static size_t bench_compress(struct bench_thread *t)
+{
+	struct bench *b = t->b;
+	unsigned type = b->type;
+	size_t dst_len, src_len;
+
+	bench_bio_reset(&t->src, b->size);
+	bench_bio_reset(&t->dst, b->size);
+
+	bch_bio_compress(b->c, &t->wp, t->dst.bio, &dst_len,
+			 t->src.bio, &src_len, &type);
+
+	t->crc = (struct bch_extent_crc128) {
+		._compressed_size	= (dst_len >> 9) - 1,
+		._uncompressed_size	= (src_len >> 9) - 1,
+		.compression_type	= type,
+	};
+
+	return src_len;
+}
+
+static size_t bench_op(struct bench_thread *t)
+{
+	struct bench *b = t->b;
+	struct nonce nonce = { .d[0] = 1 };
+
+	switch (b->op) {
+	case BENCH_CHECKSUM:
+		bch_checksum(b->c, b->type, nonce, t->src.data, b->size);
+		return b->size;
+	case BENCH_ENCRYPT:
+		bch_encrypt(b->c, BCH_CSUM_CHACHA20_POLY1305_128, nonce,
+			    t->src.data, b->size);
+		return b->size;
+	case BENCH_COMPRESS:
+		return bench_compress(t);
+	case BENCH_DECOMPRESS:
+		bench_bio_reset(&t->dst, (t->crc._compressed_size + 1) << 9);
+		bench_bio_reset(&t->out, b->size);
+
+		if (bch_bio_uncompress(b->c, t->dst.bio, t->out.bio,
+				       t->out.bio->bi_iter, t->crc))
+			die("decompression error");
+		return b->size;
+	default:
+		BUG();
+	}
+}
+
+static void *bench_thread_fn(void *arg)
+{
+	struct bench_thread *t = arg;
+	struct bench *b = t->b;
+	u64 start, now;
+	unsigned i = 0;
+
+	pthread_barrier_wait(&b->start);
+
+	start = now = bench_now();
+
+	do {
+		t->bytes += bench_op(t);
+
+		if (!(++i & 7))
+			now = bench_now();
+	} while (now - start < b->duration_ns);
+
+	t->ns = bench_now() - start;
+	return NULL;
+}
+
+static void bench_run(struct bench *b, unsigned nr_threads)
+{
+	struct bench_thread *threads = xcalloc(nr_threads, sizeof(*threads));
+	const char *type = b->op == BENCH_CHECKSUM
+		? bench_csum_types[b->type]
+		: b->op == BENCH_ENCRYPT
+		? "chacha20"
+		: bch_compression_types[b->type];
+	double mb_per_sec = 0;
+	size_t compressed = 0;
+	unsigned i;
+
+	pthread_barrier_init(&b->start, NULL, nr_threads);
+
+	for (i = 0; i < nr_threads; i++) {
+		struct bench_thread *t = &threads[i];
+
+		t->b = b;
+		bench_buf_alloc(&t->src, b->size);
+		bench_buf_alloc(&t->dst, b->size);
+		bench_buf_alloc(&t->out, b->size);
+		bench_fill(t->src.data, b->size);
+
+		if (b->op == BENCH_DECOMPRESS)
+			bench_compress(t);
+	}
+
+	if (b->op == BENCH_DECOMPRESS &&
+	    threads[0].crc.compression_type == BCH_COMPRESSION_NONE)
+		goto out;
+
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i].thread, NULL,
+				   bench_thread_fn, &threads[i]))
+			die("error creating thread");
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+
+		mb_per_sec += (double) threads[i].bytes * NSEC_PER_SEC /
+			threads[i].ns / (1 << 20);
+	}
+
+	printf("%s\t%s\t%zu\t%u\t%.1f\t",
+	       bench_ops[b->op], type, b->size, nr_threads, mb_per_sec);
+
+	if (b->op == BENCH_COMPRESS ||
+	    b->op == BENCH_DECOMPRESS) {
+		compressed = (threads[0].crc._compressed_size + 1) << 9;
+
+		printf("%.2f\n", (double) b->size / compressed);
+	} else {
+		printf("-\n");
+	}
+out:
+	for (i = 0; i < nr_threads; i++) {
+		bench_buf_free(&threads[i].src);
+		bench_buf_free(&threads[i].dst);
+		bench_buf_free(&threads[i].out);
+	}
+
+	pthread_barrier_destroy(&b->start);
+	free(threads);
+}
+
+/*
+ * Just enough of a filesystem for the checksum, encryption and compression
+ * code - nothing here touches a device:
+ */
+static struct bch_fs *bench_fs_alloc(unsigned zstd_level)
+{
+	struct bch_fs *c = xcalloc(1, sizeof(*c));
+	struct bch_key key;
+	unsigned i;
+
+	c->disk_sb = xcalloc(1, sizeof(struct bch_sb));
+	/* Compress down to 512 byte blocks, so small sizes are measured too: */
+	c->sb.block_size	= 1;
+	c->opts.zstd_level	= zstd_level;
+	mutex_init(&c->zlib_workspace_lock);
+
+	for (i = 1; i < BCH_COMPRESSION_NR; i++)
+		if (bch_check_set_has_compressed_data(c, i))
+			die("error initializing compression");
+
+	c->chacha20 = crypto_alloc_blkcipher("chacha20", 0, CRYPTO_ALG_ASYNC);
+	c->poly1305 = crypto_alloc_shash("poly1305", 0, 0);
+	if (IS_ERR(c->chacha20) || IS_ERR(c->poly1305))
+		die("error allocating ciphers");
+
+	get_random_bytes(&key, sizeof(key));
+	if (crypto_blkcipher_setkey(c->chacha20, (void *) &key, sizeof(key)))
+		die("error setting key");
+
+	return c;
+}
+
+static void parse_list(const char *arg, void (*fn)(void *, const char *),
+		       void *p)
+{
+	char *s = strdup(arg), *tok, *saveptr;
+
+	for (tok = strtok_r(s, ",", &saveptr);
+	     tok;
+	     tok = strtok_r(NULL, ",", &saveptr))
+		fn(p, tok);
+
+	free(s);
+}
+
+typedef darray(size_t) sizes_t;
+typedef darray(unsigned) threads_t;
+
+static void add_size(void *p, const char *s)
+{
+	darray_append(*(sizes_t *) p, (size_t) hatoi_validate(s, "size") << 9);
+}
+
+static void add_threads(void *p, const char *s)
+{
+	unsigned nr;
+
+	if (kstrtouint(s, 10, &nr) || !nr)
+		die("invalid thread count %s", s);
+
+	darray_append(*(threads_t *) p, nr);
+}
+
+static void add_op(void *p, const char *s)
+{
+	*(unsigned *) p |= 1U << read_string_list_or_die(s, bench_ops, "op");
+}
+
+static const struct option bench_opts[] = {
+	{ "sizes",		required_argument,	NULL, 's' },
+	{ "threads",		required_argument,	NULL, 'j' },
+	{ "time",		required_argument,	NULL, 't' },
+	{ "ops",		required_argument,	NULL, 'o' },
+	{ "zstd_level",		required_argument,	NULL, 'z' },
+	{ "help",		no_argument,		NULL, 'h' },
+	{ NULL }
+};
+
+int cmd_bench(int argc, char *argv[])
+{
+	struct bench b = { .duration_ns = NSEC_PER_SEC };
+	sizes_t sizes;
+	threads_t threads;
+	unsigned zstd_level = 3, ops = 0, nr_cpus;
+	size_t *size;
+	unsigned *nr_threads;
+	double seconds;
+	char *end;
+	int opt;
+
+	darray_init(sizes);
+	darray_init(threads);
+
+	while ((opt = getopt_long(argc, argv, "s:j:t:o:h",
+				  bench_opts, NULL)) != -1)
+		switch (opt) {
+		case 's':
+			parse_list(optarg, add_size, &sizes);
+			break;
+		case 'j':
+			parse_list(optarg, add_threads, &threads);
+			break;
+		case 't':
+			seconds = strtod(optarg, &end);
+			if (*end || seconds <= 0)
+				die("invalid time %s", optarg);
+			b.duration_ns = seconds * NSEC_PER_SEC;
+			break;
+		case 'o':
+			parse_list(optarg, add_op, &ops);
+			break;
+		case 'z':
+			if (kstrtouint(optarg, 10, &zstd_level) ||
+			    !zstd_level || zstd_level > 22)
+				die("invalid zstd level");
+			break;
+		case 'h':
+			usage();
+			exit(EXIT_SUCCESS);
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+
+	if (darray_empty(sizes)) {
+		darray_append(sizes, 4 << 10);
+		darray_append(sizes, 64 << 10);
+		darray_append(sizes, 1 << 20);
+	}
+
+	if (darray_empty(threads)) {
+		nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		darray_append(threads, 1);
+		if (nr_cpus > 1)
+			darray_append(threads, nr_cpus);
+	}
+
+	if (!ops)
+		ops = (1U << BENCH_NR) - 1;
+
+	b.c = bench_fs_alloc(zstd_level);
+
+	printf("op\ttype\tsize\tthreads\tMB/s\tratio\n");
+
+	for (b.op = 0; b.op < BENCH_NR; b.op++) {
+		unsigned nr_types = b.op == BENCH_CHECKSUM ? BCH_CSUM_NR
+			: b.op == BENCH_ENCRYPT ? 1
+			: BCH_COMPRESSION_NR;
+
+		if (!(ops & (1U << b.op)))
+			continue;
+
+		for (b.type = 0; b.type < nr_types; b.type++) {
+			if (b.op == BENCH_CHECKSUM
+			    ? b.type == BCH_CSUM_NONE
+			    : b.op != BENCH_ENCRYPT &&
+			      b.type == BCH_COMPRESSION_NONE)
+				continue;
+
+			darray_foreach(size, sizes) {
+				b.size = *size;
+
+				if ((b.op == BENCH_COMPRESS ||
+				     b.op == BENCH_DECOMPRESS) &&
+				    b.size > BCH_ENCODED_EXTENT_MAX << 9)
+					continue;
+
+				darray_foreach(nr_threads, threads)
+					bench_run(&b, *nr_threads);
+			}
+		}
+	}
+
+	darray_free(sizes);
+	darray_free(threads);
+	return 0;
+}
@@ -23,6 +23,7 @@ static void dump_usage(void)
 	     "\n"
 	     "Options:\n"
 	     "  -o output     Output qcow2 image(s)\n"
+	     "  -D            Use direct IO, bypassing the page cache\n"
 	     "  -h            Display this help and exit\n"
 	     "Report bugs to <linux-bcache@vger.kernel.org>");
 }
@@ -30,6 +31,9 @@ static void dump_usage(void)
 static void dump_one_device(struct bch_fs *c, struct bch_dev *ca, int fd)
 {
 	struct bch_sb *sb = ca->disk_sb.sb;
+	struct block_device *bdev = ca->disk_sb.bdev;
+	unsigned block_size = max_t(unsigned, btree_bytes(c) / 8,
+				    block_bytes(c));
 	ranges data;
 	unsigned i;
 
@@ -78,8 +82,11 @@ static void dump_one_device(struct bch_fs *c, struct bch_dev *ca, int fd)
 		bch_btree_iter_unlock(&iter);
 	}
 
-	qcow2_write_image(ca->disk_sb.bdev->bd_fd, fd, &data,
-			  max_t(unsigned, btree_bytes(c) / 8, block_bytes(c)));
+	/* O_DIRECT needs block_size aligned reads: */
+	qcow2_write_image(IS_ALIGNED(block_size, bdev->bd_dio_align)
+			  ? bdev->bd_fd
+			  : bdev->bd_buffered_fd,
+			  fd, &data, block_size);
 }
 
 int cmd_dump(int argc, char *argv[])
@@ -97,7 +104,7 @@ int cmd_dump(int argc, char *argv[])
 	opts.errors	= BCH_ON_ERROR_CONTINUE;
 	fsck_err_opt	= FSCK_ERR_NO;
 
-	while ((opt = getopt(argc, argv, "o:fh")) != -1)
+	while ((opt = getopt(argc, argv, "o:fDh")) != -1)
 		switch (opt) {
 		case 'o':
 			out = optarg;
@@ -105,6 +112,9 @@ int cmd_dump(int argc, char *argv[])
 		case 'f':
 			force = true;
 			break;
+		case 'D':
+			blkdev_direct_io = true;
+			break;
 		case 'h':
 			dump_usage();
 			exit(EXIT_SUCCESS);
@@ -213,6 +223,8 @@ static void list_keys_usage(void)
 	     "  -s inode:offset                       Start position to list from\n"
 	     "  -e inode:offset                       End position\n"
 	     "  -m (keys|formats)                     List mode\n"
+	     "  -c                                    Print btree node and page cache statistics when done\n"
+	     "  -D                                    Use direct IO, bypassing the page cache\n"
 	     "  -h                                    Display this help and exit\n"
 	     "Report bugs to <linux-bcache@vger.kernel.org>");
 }
@@ -230,6 +242,7 @@ int cmd_list(int argc, char *argv[])
 	enum btree_id btree_id = BTREE_ID_EXTENTS;
 	struct bpos start = POS_MIN, end = POS_MAX;
 	const char *err;
+	bool cache_stats = false;
 	int mode = 0, opt;
 
 	opts.nochanges	= true;
@@ -237,7 +250,7 @@ int cmd_list(int argc, char *argv[])
 	opts.errors	= BCH_ON_ERROR_CONTINUE;
 	fsck_err_opt	= FSCK_ERR_NO;
 
-	while ((opt = getopt(argc, argv, "b:s:e:m:h")) != -1)
+	while ((opt = getopt(argc, argv, "b:s:e:m:cDh")) != -1)
 		switch (opt) {
 		case 'b':
 			btree_id = read_string_list_or_die(optarg,
@@ -253,6 +266,12 @@ int cmd_list(int argc, char *argv[])
 			mode = read_string_list_or_die(optarg,
 						list_modes, "list mode");
 			break;
+		case 'c':
+			cache_stats = true;
+			break;
+		case 'D':
+			blkdev_direct_io = true;
+			break;
 		case 'h':
 			list_keys_usage();
 			exit(EXIT_SUCCESS);
@@ -276,6 +295,21 @@ int cmd_list(int argc, char *argv[])
 		die("Invalid mode");
 	}
 
+	if (cache_stats) {
+		struct page_pool_stats pp;
+		char buf[1024];
+
+		bch_print_btree_cache_stats(c, buf, sizeof(buf));
+		fputs(buf, stdout);
+
+		page_pool_stats(&pp);
+		printf("page allocs:		%llu\n"
+		       "page pool hits:		%llu\n"
+		       "page frees:		%llu\n"
+		       "page pool depot:	%llu\n",
+		       pp.allocs, pp.hits, pp.frees, pp.depot_bytes);
+	}
+
 	bch_fs_stop(c);
 	return 0;
 }
@@ -35,7 +35,8 @@ x('b',	block_size,		"size",			NULL)			\
 x(0,	btree_node_size,	"size",			"Default 256k")		\
 x(0,	metadata_checksum_type,	"(none|crc32c|crc64)",	NULL)			\
 x(0,	data_checksum_type,	"(none|crc32c|crc64)",	NULL)			\
-x(0,	compression_type,	"(none|lz4|gzip)",	NULL)			\
+x(0,	compression_type,	"(none|lz4|gzip|zstd)",	NULL)			\
+x(0,	zstd_level,		"#",			"zstd compression level, 1-22")\
 x(0,	data_replicas,		"#",			NULL)			\
 x(0,	metadata_replicas,	"#",			NULL)			\
 x(0,	encrypted,		NULL,			"Enable whole filesystem encryption (chacha20/poly1305)")\
@@ -73,7 +74,8 @@ static void usage(void)
 	     "      --btree_node=size       Btree node size, default 256k\n"
 	     "      --metadata_checksum_type=(none|crc32c|crc64)\n"
 	     "      --data_checksum_type=(none|crc32c|crc64)\n"
-	     "      --compression_type=(none|lz4|gzip)\n"
+	     "      --compression_type=(none|lz4|gzip|zstd)\n"
+	     "      --zstd_level=#          zstd compression level (1-22), default 3\n"
 	     "      --data_replicas=#       Number of data replicas\n"
 	     "      --metadata_replicas=#   Number of metadata replicas\n"
 	     "      --encrypted             Enable whole filesystem encryption (chacha20/poly1305)\n"
@@ -163,6 +165,11 @@ int cmd_format(int argc, char *argv[])
 						bch_compression_types,
 						"compression type");
 			break;
+		case O_zstd_level:
+			if (kstrtouint(optarg, 10, &opts.zstd_level) ||
+			    !opts.zstd_level || opts.zstd_level > 22)
+				die("invalid zstd level");
+			break;
 		case O_data_replicas:
 			if (kstrtouint(optarg, 10, &opts.data_replicas) ||
 			    dev_opts.tier >= BCH_REPLICAS_MAX)
@@ -1,9 +1,13 @@
+#include <getopt.h>
 
 #include "cmds.h"
 #include "libbcache.h"
-#include "super.h"
 #include "tools-util.h"
 
+#include "bcache.h"
+#include "journal.h"
+#include "super.h"
+
 static void usage(void)
 {
 	puts("bcache fsck - filesystem check and repair\n"
@@ -14,19 +18,35 @@ static void usage(void)
 	     "  -n     Don't repair, only check for errors\n"
 	     "  -y     Assume \"yes\" to all questions\n"
 	     "  -f     Force checking even if filesystem is marked clean\n"
-	     "  -v     Be verbose\n"
+	     "  -v     Be verbose, and print journal state when done\n"
+	     "  -D     Use direct IO, bypassing the page cache\n"
+	     "      --btree-cache-size=size\n"
+	     "         Limit memory used for caching btree nodes\n"
+	     "      --max-merge-sectors=sectors\n"
+	     "         Largest IO adjacent reads and writes are merged into\n"
+	     "         (default 2560, 0 disables merging)\n"
 	     " --h     Display this help and exit\n"
 	     "Report bugs to <linux-bcache@vger.kernel.org>");
 }
 
 int cmd_fsck(int argc, char *argv[])
 {
+	static const struct option longopts[] = {
+		{ "btree-cache-size",	required_argument,	NULL, 'C' },
+		{ "max-merge-sectors",	required_argument,	NULL, 'M' },
+		{ "help",		no_argument,		NULL, 'h' },
+		{ NULL }
+	};
 	struct bch_opts opts = bch_opts_empty();
 	struct bch_fs *c = NULL;
+	struct bch_dev *ca;
+	unsigned i;
 	const char *err;
+	u64 v;
 	int opt;
 
-	while ((opt = getopt(argc, argv, "pynfvh")) != -1)
+	while ((opt = getopt_long(argc, argv, "pynfvDh",
+				  longopts, NULL)) != -1)
 		switch (opt) {
 		case 'p':
 			fsck_err_opt = FSCK_ERR_YES;
@@ -44,6 +64,21 @@ int cmd_fsck(int argc, char *argv[])
 		case 'v':
 			opts.verbose_recovery = true;
 			break;
+		case 'D':
+			blkdev_direct_io = true;
+			break;
+		case 'C':
+			if (bch_strtoull_h(optarg, &v))
+				die("invalid btree cache size");
+
+			opts.btree_cache_size = v;
+			break;
+		case 'M':
+			if (kstrtou64(optarg, 10, &v) || v > U32_MAX)
+				die("invalid max merge sectors");
+
+			blkdev_max_sectors = v;
+			break;
 		case 'h':
 			usage();
 			exit(EXIT_SUCCESS);
@@ -56,6 +91,23 @@ int cmd_fsck(int argc, char *argv[])
 	if (err)
 		die("error opening %s: %s", argv[optind], err);
 
+	if (opt_defined(opts.verbose_recovery) && opts.verbose_recovery) {
+		char buf[PAGE_SIZE];
+
+		bch_journal_print_debug(&c->journal, buf);
+		fputs(buf, stdout);
+
+		/* flushes the shim's group commit issued, and saved: */
+		for_each_online_member(ca, c, i) {
+			struct blk_flush_queue *fq =
+				&bdev_get_queue(ca->disk_sb.bdev)->fq;
+
+			printf("dev %u flushes:\t%llu (%llu shared)\n", i,
+			       READ_ONCE(fq->nr_flushes),
+			       READ_ONCE(fq->nr_flushes_saved));
+		}
+	}
+
 	bch_fs_stop(c);
 	return 0;
 }
@@ -31,6 +31,7 @@
 #include "fs.h"
 #include "inode.h"
 #include "io.h"
+#include "keylist.h"
 #include "str_hash.h"
 #include "super.h"
 #include "xattr.h"
@@ -125,12 +126,12 @@ static void update_inode(struct bch_fs *c,
 
 static void create_dirent(struct bch_fs *c,
 			  struct bch_inode_unpacked *parent,
+			  const struct bch_hash_info *parent_hash_info,
 			  const char *name, u64 inum, mode_t mode)
 {
-	struct bch_hash_info parent_hash_info = bch_hash_info_init(parent);
 	struct qstr qname = { { { .len = strlen(name), } }, .name = name };
 
-	int ret = bch_dirent_create(c, parent->inum, &parent_hash_info,
+	int ret = bch_dirent_create(c, parent->inum, parent_hash_info,
 				    mode_to_type(mode), &qname,
 				    inum, NULL, BCH_HASH_SET_MUST_CREATE);
 	if (ret)
@@ -142,6 +143,7 @@ static void create_dirent(struct bch_fs *c,
 
 static void create_link(struct bch_fs *c,
 			struct bch_inode_unpacked *parent,
+			const struct bch_hash_info *parent_hash_info,
 			const char *name, u64 inum, mode_t mode)
 {
 	struct bch_inode_unpacked inode;
@@ -152,11 +154,12 @@ static void create_link(struct bch_fs *c,
 	inode.i_nlink++;
 	update_inode(c, &inode);
 
-	create_dirent(c, parent, name, inum, mode);
+	create_dirent(c, parent, parent_hash_info, name, inum, mode);
 }
 
 static struct bch_inode_unpacked create_file(struct bch_fs *c,
 					     struct bch_inode_unpacked *parent,
+					     const struct bch_hash_info *parent_hash_info,
 					     const char *name,
 					     uid_t uid, gid_t gid,
 					     mode_t mode, dev_t rdev)
@@ -174,7 +177,7 @@ static struct bch_inode_unpacked create_file(struct bch_fs *c,
 		die("error creating file: %s", strerror(-ret));
 
 	new_inode.inum = packed.inode.k.p.inode;
-	create_dirent(c, parent, name, new_inode.inum, mode);
+	create_dirent(c, parent, parent_hash_info, name, new_inode.inum, mode);
 
 	return new_inode;
 }
@@ -245,12 +248,40 @@ static void copy_xattrs(struct bch_fs *c, struct bch_inode_unpacked *dst,
 	}
 }
 
-static void write_data(struct bch_fs *c,
+/*
+ * Extents are added to the new filesystem in (inode, offset) order - inode
+ * numbers are allocated in the order we copy files - so instead of inserting
+ * them one at a time, they go to a bulk load of the extents btree:
+ */
+struct migrate_write_op {
+	struct bch_write_op	op;
+	struct btree_bulk_load	*load;
+};
+
+static int migrate_write_index_update(struct bch_write_op *op)
+{
+	struct btree_bulk_load *load =
+		container_of(op, struct migrate_write_op, op)->load;
+	struct keylist *keys = &op->insert_keys;
+
+	while (!bch_keylist_empty(keys)) {
+		int ret = bch_btree_bulk_load_add(load, bch_keylist_front(keys),
+						  &op->res);
+		if (ret)
+			return ret;
+
+		bch_keylist_pop_front(keys);
+	}
+
+	return 0;
+}
+
+static void write_data(struct bch_fs *c, struct btree_bulk_load *load,
 		       struct bch_inode_unpacked *dst_inode,
 		       u64 dst_offset, void *buf, size_t len)
 {
 	struct disk_reservation res;
-	struct bch_write_op op;
+	struct migrate_write_op op;
 	struct bch_write_bio bio;
 	struct bio_vec bv;
 	struct closure cl;
@@ -270,17 +301,23 @@ static void write_data(struct bch_fs *c,
 	if (ret)
 		die("error reserving space in new filesystem: %s", strerror(-ret));
 
-	bch_write_op_init(&op, c, &bio, res, c->write_points,
+	bch_write_op_init(&op.op, c, &bio, res, c->write_points,
 			  POS(dst_inode->inum, dst_offset >> 9), NULL, 0);
-	closure_call(&op.cl, bch_write, NULL, &cl);
+	op.op.index_update_fn	= migrate_write_index_update;
+	op.load			= load;
+
+	closure_call(&op.op.cl, bch_write, NULL, &cl);
 	closure_sync(&cl);
 
+	if (op.op.error)
+		die("write error: %s", strerror(-op.op.error));
+
 	dst_inode->i_sectors += len >> 9;
 }
 
 static char buf[1 << 20] __aligned(PAGE_SIZE);
 
-static void copy_data(struct bch_fs *c,
+static void copy_data(struct bch_fs *c, struct btree_bulk_load *load,
 		      struct bch_inode_unpacked *dst_inode,
 		      int src_fd, u64 start, u64 end)
 {
@@ -288,12 +325,13 @@ static void copy_data(struct bch_fs *c,
 		unsigned len = min_t(u64, end - start, sizeof(buf));
 
 		xpread(src_fd, buf, len, start);
-		write_data(c, dst_inode, start, buf, len);
+		write_data(c, load, dst_inode, start, buf, len);
 		start += len;
 	}
 }
 
-static void link_data(struct bch_fs *c, struct bch_inode_unpacked *dst,
+static void link_data(struct bch_fs *c, struct btree_bulk_load *load,
+		      struct bch_inode_unpacked *dst,
 		      u64 logical, u64 physical, u64 length)
 {
 	struct bch_dev *ca = c->devs[0];
@@ -336,8 +374,7 @@ static void link_data(struct bch_fs *c, struct bch_inode_unpacked *dst,
 			die("error reserving space in new filesystem: %s",
 			    strerror(-ret));
 
-		ret = bch_btree_insert(c, BTREE_ID_EXTENTS, &e->k_i,
-				       &res, NULL, NULL, 0);
+		ret = bch_btree_bulk_load_add(load, &e->k_i, &res);
 		if (ret)
 			die("btree insert error %s", strerror(-ret));
 
@@ -350,17 +387,18 @@ static void link_data(struct bch_fs *c, struct bch_inode_unpacked *dst,
 	}
 }
 
-static void copy_link(struct bch_fs *c, struct bch_inode_unpacked *dst,
-		      char *src)
+static void copy_link(struct bch_fs *c, struct btree_bulk_load *load,
+		      struct bch_inode_unpacked *dst, char *src)
 {
 	ssize_t ret = readlink(src, buf, sizeof(buf));
 	if (ret < 0)
 		die("readlink error: %s", strerror(errno));
 
-	write_data(c, dst, 0, buf, round_up(ret, block_bytes(c)));
+	write_data(c, load, dst, 0, buf, round_up(ret, block_bytes(c)));
 }
 
-static void copy_file(struct bch_fs *c, struct bch_inode_unpacked *dst,
+static void copy_file(struct bch_fs *c, struct btree_bulk_load *load,
+		      struct bch_inode_unpacked *dst,
 		      int src, char *src_path, ranges *extents)
 {
 	struct fiemap_iter iter;
@@ -381,7 +419,7 @@ static void copy_file(struct bch_fs *c, struct bch_inode_unpacked *dst,
 				  FIEMAP_EXTENT_ENCODED|
 				  FIEMAP_EXTENT_NOT_ALIGNED|
 				  FIEMAP_EXTENT_DATA_INLINE)) {
-			copy_data(c, dst,
+			copy_data(c, load, dst,
 				  src,
 				  round_down(e.fe_logical, block_bytes(c)),
 				  round_up(e.fe_logical + e.fe_length,
@@ -393,7 +431,7 @@ static void copy_file(struct bch_fs *c, struct bch_inode_unpacked *dst,
 			die("Unaligned extent in %s - can't handle", src_path);
 
 		range_add(extents, e.fe_physical, e.fe_length);
-		link_data(c, dst, e.fe_logical, e.fe_physical, e.fe_length);
+		link_data(c, load, dst, e.fe_logical, e.fe_physical, e.fe_length);
 	}
 }
 
@@ -403,6 +441,7 @@ struct copy_fs_state {
 
 	GENRADIX(u64)		hardlinks;
 	ranges			extents;
+	struct btree_bulk_load	extents_load;
 };
 
 static void copy_dir(struct copy_fs_state *s,
@@ -410,6 +449,8 @@ static void copy_dir(struct copy_fs_state *s,
 		     struct bch_inode_unpacked *dst,
 		     int src_fd, const char *src_path)
 {
+	/* Hash info is expensive to compute (it's a sha256), so only do it once: */
+	struct bch_hash_info dst_hash_info = bch_hash_info_init(dst);
 	DIR *dir = fdopendir(src_fd);
 	struct dirent *d;
 
@@ -438,11 +479,12 @@ static void copy_dir(struct copy_fs_state *s,
 			: NULL;
 
 		if (dst_inum && *dst_inum) {
-			create_link(c, dst, d->d_name, *dst_inum, S_IFREG);
+			create_link(c, dst, &dst_hash_info,
+				    d->d_name, *dst_inum, S_IFREG);
 			goto next;
 		}
 
-		inode = create_file(c, dst, d->d_name,
+		inode = create_file(c, dst, &dst_hash_info, d->d_name,
 				    stat.st_uid, stat.st_gid,
 				    stat.st_mode, stat.st_rdev);
 
@@ -464,13 +506,14 @@ static void copy_dir(struct copy_fs_state *s,
 			inode.i_size = stat.st_size;
 
 			fd = xopen(d->d_name, O_RDONLY|O_NOATIME);
-			copy_file(c, &inode, fd, child_path, &s->extents);
+			copy_file(c, &s->extents_load, &inode, fd,
+				  child_path, &s->extents);
 			close(fd);
 			break;
 		case DT_LNK:
 			inode.i_size = stat.st_size;
 
-			copy_link(c, &inode, d->d_name);
+			copy_link(c, &s->extents_load, &inode, d->d_name);
 			break;
 		case DT_FIFO:
 		case DT_CHR:
@@ -540,22 +583,25 @@ static ranges reserve_new_fs_space(const char *file_path, unsigned block_size,
 }
 
 static void reserve_old_fs_space(struct bch_fs *c,
+				 struct btree_bulk_load *load,
 				 struct bch_inode_unpacked *root_inode,
 				 ranges *extents)
 {
 	struct bch_dev *ca = c->devs[0];
+	struct bch_hash_info root_hash_info = bch_hash_info_init(root_inode);
 	struct bch_inode_unpacked dst;
 	struct hole_iter iter;
 	struct range i;
 
-	dst = create_file(c, root_inode, "old_migrated_filesystem",
+	dst = create_file(c, root_inode, &root_hash_info,
+			  "old_migrated_filesystem",
 			  0, 0, S_IFREG|0400, 0);
 	dst.i_size = bucket_to_sector(ca, ca->mi.nbuckets) << 9;
 
 	ranges_sort_merge(extents);
 
 	for_each_hole(iter, *extents, bucket_to_sector(ca, ca->mi.nbuckets) << 9, i)
-		link_data(c, &dst, i.start, i.start, i.end - i.start);
+		link_data(c, load, &dst, i.start, i.start, i.end - i.start);
 
 	update_inode(c, &dst);
 }
@@ -583,10 +629,19 @@ static void copy_fs(struct bch_fs *c, int src_fd, const char *src_path,
 		.extents	= *extents,
 	};
 
+	ret = bch_btree_bulk_load_init(&s.extents_load, c,
+				       BTREE_ID_EXTENTS, 75);
+	if (ret)
+		die("error starting extents btree load: %s", strerror(-ret));
+
 	/* now, copy: */
 	copy_dir(&s, c, &root_inode, src_fd, src_path);
 
-	reserve_old_fs_space(c, &root_inode, &s.extents);
+	reserve_old_fs_space(c, &s.extents_load, &root_inode, &s.extents);
+
+	ret = bch_btree_bulk_load_finish(&s.extents_load);
+	if (ret)
+		die("error loading extents btree: %s", strerror(-ret));
 
 	update_inode(c, &root_inode);
 
@@ -36,4 +36,6 @@ int cmd_list(int argc, char *argv[]);
 int cmd_migrate(int argc, char *argv[]);
 int cmd_migrate_superblock(int argc, char *argv[]);
 
+int cmd_bench(int argc, char *argv[]);
+
 #endif /* _CMDS_H */
@@ -976,10 +976,13 @@ LE64_BITMASK(BCH_SB_JOURNAL_ENTRY_SIZE,	struct bch_sb, flags[1], 14, 20);
 LE64_BITMASK(BCH_SB_META_REPLICAS_REQ,	struct bch_sb, flags[1], 20, 24);
 LE64_BITMASK(BCH_SB_DATA_REPLICAS_REQ,	struct bch_sb, flags[1], 24, 28);
 
+LE64_BITMASK(BCH_SB_ZSTD_LEVEL,		struct bch_sb, flags[1], 28, 33);
+
 /* Features: */
 enum bch_sb_features {
 	BCH_FEATURE_LZ4			= 0,
 	BCH_FEATURE_GZIP		= 1,
+	BCH_FEATURE_ZSTD		= 2,
 };
 
 /* options: */
@@ -1025,7 +1028,8 @@ enum bch_compression_opts {
 	BCH_COMPRESSION_NONE		= 0,
 	BCH_COMPRESSION_LZ4		= 1,
 	BCH_COMPRESSION_GZIP		= 2,
-	BCH_COMPRESSION_NR		= 3,
+	BCH_COMPRESSION_ZSTD		= 3,
+	BCH_COMPRESSION_NR		= 4,
 };
 
 /* backing device specific stuff: */
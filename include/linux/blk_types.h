@@ -59,6 +59,11 @@ struct bio {
 	struct bio_vec		bi_inline_vecs[0];
 };
 
+struct bio_list {
+	struct bio *head;
+	struct bio *tail;
+};
+
 #define BIO_OP_SHIFT	(8 * sizeof(unsigned int) - REQ_OP_BITS)
 #define bio_op(bio)	((bio)->bi_opf >> BIO_OP_SHIFT)
 
@@ -113,6 +118,7 @@ enum rq_flag_bits {
 	__REQ_SYNC,		/* request is sync (sync write or read) */
 	__REQ_META,		/* metadata io request */
 	__REQ_PRIO,		/* boost priority in cfq */
+	__REQ_RAHEAD,		/* read ahead, can fail anytime */
 
 	__REQ_FUA,		/* forced unit access */
 	__REQ_PREFLUSH,		/* request for cache flush */
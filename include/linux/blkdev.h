@@ -2,14 +2,18 @@
 #define __TOOLS_LINUX_BLKDEV_H
 
 #include <linux/backing-dev.h>
+#include <linux/bitops.h>
 #include <linux/blk_types.h>
 #include <linux/kobject.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
 
 typedef u64 sector_t;
 typedef unsigned fmode_t;
 
 struct bio;
 struct user_namespace;
+struct virt_dev;
 
 #define MINORBITS	20
 #define MINORMASK	((1U << MINORBITS) - 1)
@@ -59,10 +63,45 @@ static inline struct inode *file_inode(const struct file *f)
 
 #define BDEVNAME_SIZE	32
 
+#define BLK_DEF_MAX_SECTORS	2560
+
+/*
+ * userspace only: max_sectors of devices opened from now on, i.e. the largest
+ * IO plugged bios get merged into - the tools may set it before opening:
+ */
+extern unsigned blkdev_max_sectors;
+
+/* userspace only: open devices with O_DIRECT, bypassing the page cache: */
+extern bool blkdev_direct_io;
+
+struct queue_limits {
+	unsigned int		max_sectors;
+};
+
+/*
+ * Flushes are group committed: callers that need a flush while one is already
+ * in flight wait on pending, and all share the next flush that's issued:
+ */
+struct blk_flush_queue {
+	spinlock_t		lock;
+	bool			flush_in_flight;
+	struct list_head	running;
+	struct list_head	pending;
+
+	u64			nr_flushes;
+	/* flush requests satisfied by another caller's flush: */
+	u64			nr_flushes_saved;
+};
+
 struct request_queue {
+	unsigned long		queue_flags;
+	struct queue_limits	limits;
+	struct blk_flush_queue	fq;
 	struct backing_dev_info backing_dev_info;
 };
 
+#define QUEUE_FLAG_DISCARD	14	/* supports DISCARD */
+
 struct gendisk {
 };
 
@@ -81,18 +120,54 @@ struct block_device {
 	struct gendisk		*bd_disk;
 	struct gendisk		__bd_disk;
 	int			bd_fd;
+	/* for IOs that aren't aligned for O_DIRECT, see blkdev.c: */
+	int			bd_buffered_fd;
+	unsigned		bd_dio_align;
+	/* read only devices are mmapped, see blkdev.c: */
+	void			*bd_map;
+	size_t			bd_map_size;
+	/* mem: and slow: devices, see blkdev.c: */
+	struct virt_dev		*bd_virt;
 };
 
 void generic_make_request(struct bio *);
 int submit_bio_wait(struct bio *);
+
+/*
+ * While a plug is held, bios submitted by this thread are queued up, and
+ * adjacent bios are merged (up to the queue's max_sectors) when the plug is
+ * finished - or when the thread blocks in schedule():
+ */
+#define BLK_MAX_PLUG_BIOS	256
+
+struct blk_plug {
+	struct bio_list		bios;
+	unsigned		nr_bios;
+};
+
+void blk_start_plug(struct blk_plug *);
+void blk_finish_plug(struct blk_plug *);
+void blk_flush_plug(struct blk_plug *);
+int blkdev_issue_flush(struct block_device *, gfp_t, sector_t *);
 int blkdev_issue_discard(struct block_device *, sector_t,
 			 sector_t, gfp_t, unsigned long);
 
 #define bdev_get_queue(bdev)		(&((bdev)->queue))
 
-#define blk_queue_discard(q)		((void) (q), 0)
+#define blk_queue_discard(q)	test_bit(QUEUE_FLAG_DISCARD, &(q)->queue_flags)
 #define blk_queue_nonrot(q)		((void) (q), 0)
 
+static inline unsigned int queue_max_sectors(struct request_queue *q)
+{
+	return q->limits.max_sectors;
+}
+
+static inline void blk_queue_max_hw_sectors(struct request_queue *q,
+					    unsigned int max_hw_sectors)
+{
+	q->limits.max_sectors = max_hw_sectors;
+}
+
 static inline struct backing_dev_info *blk_get_backing_dev_info(struct block_device *bdev)
 {
 	struct request_queue *q = bdev_get_queue(bdev);
@@ -1,12 +1,19 @@
 #ifndef __LINUX_CPUMASK_H
 #define __LINUX_CPUMASK_H
 
-#define num_online_cpus()	1U
-#define num_possible_cpus()	1U
+#include <linux/compiler.h>
+
+/* number of percpu shards, fixed at startup - see linux/percpu.c: */
+extern unsigned nr_cpu_ids;
+/* cpus we can actually run on, for sizing parallel work - also fixed: */
+extern unsigned nr_online_cpus;
+
+#define num_online_cpus()	nr_online_cpus
+#define num_possible_cpus()	nr_cpu_ids
 #define num_present_cpus()	1U
 #define num_active_cpus()	1U
 #define cpu_online(cpu)		((cpu) == 0)
-#define cpu_possible(cpu)	((cpu) == 0)
+#define cpu_possible(cpu)	((cpu) < num_possible_cpus())
 #define cpu_present(cpu)	((cpu) == 0)
 #define cpu_active(cpu)		((cpu) == 0)
 
@@ -17,7 +24,8 @@
 #define for_each_cpu_and(cpu, mask, and)	\
 	for ((cpu) = 0; (cpu) < 1; (cpu)++, (void)mask, (void)and)
 
-#define for_each_possible_cpu(cpu) for_each_cpu((cpu), 1)
+#define for_each_possible_cpu(cpu)		\
+	for ((cpu) = 0; (cpu) < num_possible_cpus(); (cpu)++)
 #define for_each_online_cpu(cpu)   for_each_cpu((cpu), 1)
 #define for_each_present_cpu(cpu)  for_each_cpu((cpu), 1)
 
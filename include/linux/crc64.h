@@ -0,0 +1,17 @@
+#ifndef _LINUX_CRC64_H
+#define _LINUX_CRC64_H
+
+#include <linux/types.h>
+
+/*
+ * ECMA-182 crc64, non reflected: the initial value and final xor are up to the
+ * caller.
+ */
+u64 crc64_be(u64 crc, const void *p, size_t len);
+
+/*
+ * Returns crc64_be(crc1, p2, len2), given crc2 = crc64_be(0, p2, len2):
+ */
+u64 crc64_be_combine(u64 crc1, u64 crc2, size_t len2);
+
+#endif /* _LINUX_CRC64_H */
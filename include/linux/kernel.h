@@ -85,6 +85,9 @@
 	(void) (&_min1 == &_min2);		\
 	_min1 < _min2 ? _min1 : _min2; })
 
+#define min3(x, y, z) min((typeof(x))min(x, y), z)
+#define max3(x, y, z) max((typeof(x))max(x, y), z)
+
 #define min_t(type, x, y) ({			\
 	type __min1 = (x);			\
 	type __min2 = (y);			\
@@ -105,7 +108,7 @@
 
 #define might_sleep()
 
-#define NR_CPUS			32
+#define NR_CPUS			256
 
 #define cpu_relax()		do {} while (0)
 #define cpu_relax_lowlatency()	do {} while (0)
@@ -127,6 +130,8 @@ long simple_strtol(const char *,char **,unsigned int);
 unsigned long long simple_strtoull(const char *,char **,unsigned int);
 long long simple_strtoll(const char *,char **,unsigned int);
 
+unsigned long long memparse(const char *ptr, char **retptr);
+
 int __must_check _kstrtoul(const char *s, unsigned int base, unsigned long *res);
 int __must_check _kstrtol(const char *s, unsigned int base, long *res);
 
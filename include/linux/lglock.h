@@ -3,16 +3,54 @@
 
 #include <pthread.h>
 
+#include <linux/errno.h>
+#include <linux/percpu.h>
+
+/*
+ * A lock per percpu shard: lg_local_lock() only takes the current thread's, so
+ * that threads updating their own percpu data don't contend with each other -
+ * lg_global_lock() takes all of them:
+ */
 struct lglock {
-	pthread_mutex_t lock;
+	pthread_mutex_t __percpu *lock;
 };
 
-#define lg_lock_free(l)		do {} while (0)
-#define lg_lock_init(l)		pthread_mutex_init(&(l)->lock, NULL)
+static inline int lg_lock_init(struct lglock *lg)
+{
+	int cpu;
+
+	lg->lock = alloc_percpu(pthread_mutex_t);
+	if (!lg->lock)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu)
+		pthread_mutex_init(per_cpu_ptr(lg->lock, cpu), NULL);
+	return 0;
+}
+
+static inline void lg_lock_free(struct lglock *lg)
+{
+	free_percpu(lg->lock);
+	lg->lock = NULL;
+}
+
+#define lg_local_lock(lg)	pthread_mutex_lock(this_cpu_ptr((lg)->lock))
+#define lg_local_unlock(lg)	pthread_mutex_unlock(this_cpu_ptr((lg)->lock))
+
+static inline void lg_global_lock(struct lglock *lg)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		pthread_mutex_lock(per_cpu_ptr(lg->lock, cpu));
+}
+
+static inline void lg_global_unlock(struct lglock *lg)
+{
+	int cpu;
 
-#define lg_local_lock(l)	pthread_mutex_lock(&(l)->lock)
-#define lg_local_unlock(l)	pthread_mutex_unlock(&(l)->lock)
-#define lg_global_lock(l)	pthread_mutex_lock(&(l)->lock)
-#define lg_global_unlock(l)	pthread_mutex_unlock(&(l)->lock)
+	for (cpu = nr_cpu_ids - 1; cpu >= 0; cpu--)
+		pthread_mutex_unlock(per_cpu_ptr(lg->lock, cpu));
+}
 
 #endif /* __TOOLS_LINUX_LGLOCK_H */
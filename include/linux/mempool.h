@@ -12,24 +12,32 @@ struct kmem_cache;
 
 typedef struct mempool_s {
 	size_t		elem_size;
+	/* page pools allocate from the page allocator: */
+	bool		pages;
+	unsigned	order;
 } mempool_t;
 
 static inline bool mempool_initialized(mempool_t *pool)
 {
-	return true;
+	return pool->elem_size != 0;
 }
 
 extern int mempool_resize(mempool_t *pool, int new_min_nr);
 
 static inline void mempool_free(void *element, mempool_t *pool)
 {
-	free(element);
+	if (pool->pages)
+		__free_pages(element, pool->order);
+	else
+		free(element);
 }
 
 static inline void *mempool_alloc(mempool_t *pool, gfp_t gfp_mask) __malloc
 {
 	BUG_ON(!pool->elem_size);
-	return kmalloc(pool->elem_size, gfp_mask);
+	return pool->pages
+		? alloc_pages(gfp_mask, pool->order)
+		: kmalloc(pool->elem_size, gfp_mask);
 }
 
 static inline void mempool_exit(mempool_t *pool) {}
@@ -43,6 +51,7 @@ static inline int
 mempool_init_slab_pool(mempool_t *pool, int min_nr, struct kmem_cache *kc)
 {
 	pool->elem_size = 0;
+	pool->pages	= false;
 	return 0;
 }
 
@@ -50,33 +59,39 @@ static inline mempool_t *
 mempool_create_slab_pool(int min_nr, struct kmem_cache *kc)
 {
 	mempool_t *pool = malloc(sizeof(*pool));
-	pool->elem_size = 0;
+
+	mempool_init_slab_pool(pool, min_nr, kc);
 	return pool;
 }
 
 static inline int mempool_init_kmalloc_pool(mempool_t *pool, int min_nr, size_t size)
 {
 	pool->elem_size = size;
+	pool->pages	= false;
 	return 0;
 }
 
 static inline mempool_t *mempool_create_kmalloc_pool(int min_nr, size_t size)
 {
 	mempool_t *pool = malloc(sizeof(*pool));
-	pool->elem_size = size;
+
+	mempool_init_kmalloc_pool(pool, min_nr, size);
 	return pool;
 }
 
 static inline int mempool_init_page_pool(mempool_t *pool, int min_nr, int order)
 {
 	pool->elem_size = PAGE_SIZE << order;
+	pool->pages	= true;
+	pool->order	= order;
 	return 0;
 }
 
 static inline mempool_t *mempool_create_page_pool(int min_nr, int order)
 {
 	mempool_t *pool = malloc(sizeof(*pool));
-	pool->elem_size = PAGE_SIZE << order;
+
+	mempool_init_page_pool(pool, min_nr, order);
 	return pool;
 }
 
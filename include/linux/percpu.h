@@ -1,12 +1,41 @@
 #ifndef __TOOLS_LINUX_PERCPU_H
 #define __TOOLS_LINUX_PERCPU_H
 
+#include <linux/cache.h>
+#include <linux/compiler.h>
+#include <linux/cpumask.h>
+#include <linux/kernel.h>
+
 #define __percpu
 
-#define free_percpu(percpu)				free(percpu)
+/*
+ * Userspace has no cpus to be local to, so the "cpus" here are per thread
+ * shards: a thread gets its own shard the first time it uses percpu data, and
+ * gives it back when it exits.
+ *
+ * Like the kernel's percpu areas, every cpu's copy of a percpu allocation is
+ * in its own unit of PCPU_UNIT_SIZE bytes, so a pointer to any object in a
+ * percpu allocation can be shifted to another cpu's copy by a fixed offset -
+ * that's what lets this_cpu_add() and friends take an lvalue:
+ */
+#define PCPU_UNIT_SIZE		(1U << 20)
+
+extern __thread int __pcpu_cpu;
+int __pcpu_cpu_get(void);
+
+static inline int raw_smp_processor_id(void)
+{
+	int cpu = __pcpu_cpu;
+
+	return likely(cpu >= 0) ? cpu : __pcpu_cpu_get();
+}
+
+#define smp_processor_id()	raw_smp_processor_id()
 
-#define __alloc_percpu_gfp(size, align, gfp)		calloc(1, size)
-#define __alloc_percpu(size, align)			calloc(1, size)
+void __percpu *__alloc_percpu(size_t size, size_t align);
+void free_percpu(void __percpu *ptr);
+
+#define __alloc_percpu_gfp(size, align, gfp)	__alloc_percpu(size, align)
 
 #define alloc_percpu_gfp(type, gfp)					\
 	(typeof(type) __percpu *)__alloc_percpu_gfp(sizeof(type),	\
@@ -17,8 +46,14 @@
 
 #define __verify_pcpu_ptr(ptr)
 
-#define per_cpu_ptr(ptr, cpu)	(ptr)
-#define raw_cpu_ptr(ptr)	(ptr)
+#define SHIFT_PERCPU_PTR(ptr, offset)					\
+	((typeof(ptr)) ((unsigned long) (ptr) + (offset)))
+
+#define per_cpu_offset(cpu)	((unsigned long) (cpu) * PCPU_UNIT_SIZE)
+#define __my_cpu_offset		per_cpu_offset(raw_smp_processor_id())
+
+#define per_cpu_ptr(ptr, cpu)	SHIFT_PERCPU_PTR(ptr, per_cpu_offset(cpu))
+#define raw_cpu_ptr(ptr)	SHIFT_PERCPU_PTR(ptr, __my_cpu_offset)
 #define this_cpu_ptr(ptr)	raw_cpu_ptr(ptr)
 
 #define __pcpu_size_call_return(stem, variable)				\
@@ -161,18 +196,30 @@ do {									\
 #define __this_cpu_inc_return(pcp)	__this_cpu_add_return(pcp, 1)
 #define __this_cpu_dec_return(pcp)	__this_cpu_add_return(pcp, -1)
 
-#define this_cpu_read(pcp)		((pcp))
-#define this_cpu_write(pcp, val)	((pcp) = val)
-#define this_cpu_add(pcp, val)		((pcp) += val)
-#define this_cpu_and(pcp, val)		((pcp) &= val)
-#define this_cpu_or(pcp, val)		((pcp) |= val)
-#define this_cpu_add_return(pcp, val)	((pcp) += val)
+/*
+ * Threads normally have a shard to themselves, but when there are more threads
+ * than shards they share - so these are atomic. The shard's cacheline isn't
+ * contended, so that's cheap.
+ *
+ * Updates done directly through this_cpu_ptr() under preempt_disable() (which
+ * is a no-op here) aren't protected against a thread sharing the shard; those
+ * counters can be off when shards are shared, unless they're also protected by
+ * lg_local_lock(), which is per shard.
+ */
+#define this_cpu_read(pcp)						\
+	__atomic_load_n(raw_cpu_ptr(&(pcp)), __ATOMIC_RELAXED)
+#define this_cpu_write(pcp, val)					\
+	__atomic_store_n(raw_cpu_ptr(&(pcp)), (val), __ATOMIC_RELAXED)
+#define this_cpu_add(pcp, val)						\
+	((void) __atomic_add_fetch(raw_cpu_ptr(&(pcp)), (val), __ATOMIC_RELAXED))
+#define this_cpu_and(pcp, val)						\
+	((void) __atomic_and_fetch(raw_cpu_ptr(&(pcp)), (val), __ATOMIC_RELAXED))
+#define this_cpu_or(pcp, val)						\
+	((void) __atomic_or_fetch(raw_cpu_ptr(&(pcp)), (val), __ATOMIC_RELAXED))
+#define this_cpu_add_return(pcp, val)					\
+	__atomic_add_fetch(raw_cpu_ptr(&(pcp)), (val), __ATOMIC_RELAXED)
 #define this_cpu_xchg(pcp, nval)					\
-({									\
-	typeof(pcp) _r = (pcp);						\
-	(pcp) = (nval);							\
-	_r;								\
-})
+	__atomic_exchange_n(raw_cpu_ptr(&(pcp)), (nval), __ATOMIC_RELAXED)
 
 #define this_cpu_cmpxchg(pcp, oval, nval) \
 	__pcpu_size_call_return2(this_cpu_cmpxchg_, pcp, oval, nval)
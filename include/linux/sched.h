@@ -89,6 +89,7 @@ struct task_struct {
 	bool			on_cpu;
 	char			comm[TASK_COMM_LEN];
 	struct bio_list		*bio_list;
+	struct blk_plug		*plug;
 };
 
 extern __thread struct task_struct *current;
@@ -29,7 +29,8 @@ static inline void *krealloc(void *old, size_t size, gfp_t flags)
 	if (new && (flags & __GFP_ZERO))
 		memset(new, 0, size);
 
-	if (new) {
+	/* krealloc(NULL, ...) is just kmalloc(): */
+	if (new && old) {
 		memcpy(new, old,
 		       min(malloc_usable_size(old),
 			   malloc_usable_size(new)));
@@ -50,33 +51,30 @@ static inline void *krealloc(void *old, size_t size, gfp_t flags)
 #define kvfree(p)			free(p)
 #define kzfree(p)			free(p)
 
-static inline struct page *alloc_pages(gfp_t flags, unsigned int order)
-{
-	size_t size = PAGE_SIZE << order;
-	void *p = memalign(PAGE_SIZE, size);
+/*
+ * Pages come from a pool of freed pages, see linux/page_alloc.c - allocations
+ * of order PAGE_POOL_ORDERS and up go straight to malloc:
+ */
+#define PAGE_POOL_ORDERS		10
 
-	if (p && (flags & __GFP_ZERO))
-		memset(p, 0, size);
+struct page *alloc_pages(gfp_t flags, unsigned int order);
+void __free_pages(struct page *page, unsigned int order);
 
-	return p;
-}
+struct page_pool_stats {
+	u64			allocs;
+	u64			frees;
+	u64			hits;		/* allocs served from the pool */
+	u64			depot_bytes;	/* free pages held globally */
+};
+
+void page_pool_stats(struct page_pool_stats *);
 
 #define alloc_page(gfp)			alloc_pages(gfp, 0)
 
 #define __get_free_pages(gfp, order)	((unsigned long) alloc_pages(gfp, order))
 #define __get_free_page(gfp)		__get_free_pages(gfp, 0)
 
-#define __free_pages(page, order)			\
-do {							\
-	(void) order;					\
-	free(page);					\
-} while (0)
-
-#define free_pages(addr, order)				\
-do {							\
-	(void) order;					\
-	free((void *) (addr));				\
-} while (0)
+#define free_pages(addr, order)		__free_pages((void *) (addr), order)
 
 #define __free_page(page) __free_pages((page), 0)
 #define free_page(addr) free_pages((addr), 0)
@@ -93,9 +91,17 @@ do {							\
 
 static inline void vunmap(const void *addr) {}
 
+/* We can't remap pages in userspace - only works if they're contiguous: */
 static inline void *vmap(struct page **pages, unsigned int count,
 			 unsigned long flags, unsigned prot)
 {
+	unsigned i;
+
+	for (i = 1; i < count; i++)
+		if (page_address(pages[i]) !=
+		    page_address(pages[0]) + i * PAGE_SIZE)
+			return NULL;
+
 	return page_address(pages[0]);
 }
 
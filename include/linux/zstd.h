@@ -0,0 +1,20 @@
+#ifndef _LINUX_ZSTD_H
+#define _LINUX_ZSTD_H
+
+#define ZSTD_STATIC_LINKING_ONLY
+#define ZSTD_DISABLE_DEPRECATE_WARNINGS
+#include <zstd.h>
+
+/* The kernel's zstd api, on top of libzstd's static context api: */
+
+#define ZSTD_CCtxWorkspaceBound(cparams)			\
+	ZSTD_estimateCCtxSize_usingCParams(cparams)
+#define ZSTD_DCtxWorkspaceBound()	ZSTD_estimateDCtxSize()
+
+#define ZSTD_initCCtx(workspace, size)	ZSTD_initStaticCCtx(workspace, size)
+#define ZSTD_initDCtx(workspace, size)	ZSTD_initStaticDCtx(workspace, size)
+
+#define ZSTD_compressCCtx(ctx, dst, dst_len, src, src_len, params)	\
+	ZSTD_compress_advanced(ctx, dst, dst_len, src, src_len, NULL, 0, params)
+
+#endif /* _LINUX_ZSTD_H */
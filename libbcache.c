@@ -175,6 +175,7 @@ struct bch_sb *bcache_format(struct format_opts opts,
 	SET_BCH_SB_META_CSUM_TYPE(sb,		opts.meta_csum_type);
 	SET_BCH_SB_DATA_CSUM_TYPE(sb,		opts.data_csum_type);
 	SET_BCH_SB_COMPRESSION_TYPE(sb,		opts.compression_type);
+	SET_BCH_SB_ZSTD_LEVEL(sb,		opts.zstd_level);
 
 	SET_BCH_SB_BTREE_NODE_SIZE(sb,		opts.btree_node_size);
 	SET_BCH_SB_GC_RESERVE(sb,		8);
@@ -324,6 +325,7 @@ void bcache_super_print(struct bch_sb *sb, int units)
 	       "Metadata checksum type:		%s\n"
 	       "Data checksum type:		%s\n"
 	       "Compression type:		%s\n"
+	       "Zstd compression level:		%llu\n"
 
 	       "String hash type:		%s\n"
 	       "32 bit inodes:			%llu\n"
@@ -362,6 +364,8 @@ void bcache_super_print(struct bch_sb *sb, int units)
 	       ? bch_compression_types[BCH_SB_COMPRESSION_TYPE(sb)]
 	       : "unknown",
 
+	       BCH_SB_ZSTD_LEVEL(sb),
+
 	       BCH_SB_STR_HASH_TYPE(sb) < BCH_STR_HASH_NR
 	       ? bch_str_hash_types[BCH_SB_STR_HASH_TYPE(sb)]
 	       : "unknown",
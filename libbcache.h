@@ -38,6 +38,7 @@ struct format_opts {
 	unsigned	meta_csum_type;
 	unsigned	data_csum_type;
 	unsigned	compression_type;
+	unsigned	zstd_level;
 
 	bool		encrypted;
 	char		*passphrase;
@@ -53,6 +54,7 @@ static inline struct format_opts format_opts_default()
 		.data_replicas		= 1,
 		.meta_replicas_required	= 1,
 		.data_replicas_required	= 1,
+		.zstd_level		= 3,
 	};
 }
 
@@ -817,6 +817,34 @@ static bool bch_allocator_push(struct bch_dev *ca, long bucket)
 	return ret;
 }
 
+/*
+ * Discard the run of buckets at the front of free_inc that are contiguous on
+ * disk with a single discard, instead of one discard per bucket: returns the
+ * number of buckets at the front of free_inc that no longer need discarding
+ */
+static size_t bch_discard_free_inc(struct bch_dev *ca)
+{
+	long bucket, start = fifo_peek(&ca->free_inc);
+	size_t iter, nr = 0;
+
+	if (!ca->mi.discard ||
+	    !blk_queue_discard(bdev_get_queue(ca->disk_sb.bdev)))
+		return fifo_used(&ca->free_inc);
+
+	spin_lock(&ca->freelist_lock);
+	fifo_for_each_entry(bucket, &ca->free_inc, iter) {
+		if (bucket != start + nr)
+			break;
+		nr++;
+	}
+	spin_unlock(&ca->freelist_lock);
+
+	blkdev_issue_discard(ca->disk_sb.bdev,
+			     bucket_to_sector(ca, start),
+			     ca->mi.bucket_size * nr, GFP_NOIO, 0);
+	return nr;
+}
+
 static void bch_find_empty_buckets(struct bch_fs *c, struct bch_dev *ca)
 {
 	u16 last_seq_ondisk = c->journal.last_seq_ondisk;
@@ -858,6 +886,7 @@ static int bch_allocator_thread(void *arg)
 {
 	struct bch_dev *ca = arg;
 	struct bch_fs *c = ca->fs;
+	size_t discarded = 0;
 	int ret;
 
 	set_freezable();
@@ -880,11 +909,8 @@ static int bch_allocator_thread(void *arg)
 			 * dropped bucket lock
 			 */
 
-			if (ca->mi.discard &&
-			    blk_queue_discard(bdev_get_queue(ca->disk_sb.bdev)))
-				blkdev_issue_discard(ca->disk_sb.bdev,
-					bucket_to_sector(ca, bucket),
-					ca->mi.bucket_size, GFP_NOIO, 0);
+			if (!discarded)
+				discarded = bch_discard_free_inc(ca);
 
 			while (1) {
 				set_current_state(TASK_INTERRUPTIBLE);
@@ -900,6 +926,7 @@ static int bch_allocator_thread(void *arg)
 			}
 
 			__set_current_state(TASK_RUNNING);
+			discarded--;
 		}
 
 		down_read(&c->gc_lock);
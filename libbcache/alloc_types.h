@@ -93,6 +93,13 @@ struct write_point {
 	 */
 	struct dev_group	*group;
 
+	/*
+	 * How compressing data written through this write point has been going,
+	 * see compress.c - only a hint, so not locked:
+	 */
+	u8			compress_fail;
+	u8			compress_skip;
+
 	/*
 	 * Otherwise do a normal replicated bucket allocation that could come
 	 * from any device in tier 0 (foreground write)
@@ -566,16 +566,31 @@ struct bch_fs {
 	 * high order page allocations can be rather expensive, and it's quite
 	 * common to delete and allocate btree nodes in quick succession. It
 	 * should never grow past ~2-3 nodes in practice.
+	 *
+	 * Cached nodes are on one of the btree_cache_lru lists, and recently
+	 * evicted nodes are remembered in btree_cache_ghosts - see the comment
+	 * on the replacement policy in btree_cache.c.
 	 */
 	struct mutex		btree_cache_lock;
-	struct list_head	btree_cache;
+	struct list_head	btree_cache_lru[BTREE_LRU_NR];
 	struct list_head	btree_cache_freeable;
 	struct list_head	btree_cache_freed;
 
-	/* Number of elements in btree_cache + btree_cache_freeable lists */
+	unsigned		btree_cache_lru_nr[BTREE_LRU_NR];
+	unsigned		btree_cache_recent_target;
+	struct btree_cache_ghost *btree_cache_ghosts;
+	unsigned		btree_cache_ghosts_nr[BTREE_LRU_NR];
+
+	/* Protected by btree_cache_lock: */
+	u64			btree_cache_promoted;
+	u64			btree_cache_evicted[BTREE_LRU_NR];
+	u64			btree_cache_ghost_hits[BTREE_LRU_NR];
+
+	/* Number of elements in btree_cache_lru + btree_cache_freeable lists */
 	unsigned		btree_cache_used;
 	unsigned		btree_cache_reserve;
 	struct shrinker		btree_cache_shrink;
+	struct work_struct	btree_cache_limit_work;
 
 	/*
 	 * If we need to allocate memory for a new btree node and that
@@ -586,6 +601,15 @@ struct bch_fs {
 	struct closure_waitlist	mca_wait;
 	struct task_struct	*btree_cache_alloc_lock;
 
+	/*
+	 * Btree node lookups that hit in the cache, readahead issued and used,
+	 * and synchronous reads:
+	 */
+	atomic64_t		btree_cache_hits;
+	atomic64_t		btree_readahead_reads;
+	atomic64_t		btree_readahead_hits;
+	atomic64_t		btree_cache_misses;
+
 	mempool_t		btree_reserve_pool;
 
 	/*
@@ -606,6 +630,9 @@ struct bch_fs {
 	struct list_head	btree_interior_update_list;
 	struct mutex		btree_interior_update_lock;
 
+	/* bulk loads whose nodes aren't reachable yet - gc marks them: */
+	struct list_head	btree_bulk_loads;
+
 	struct workqueue_struct	*wq;
 	/* copygc needs its own workqueue for index updates.. */
 	struct workqueue_struct	*copygc_wq;
@@ -713,10 +740,19 @@ struct bch_fs {
 	mempool_t		bio_bounce_pages;
 
 	mempool_t		lz4_workspace_pool;
+	mempool_t		zstd_workspace_pool;
 	void			*zlib_workspace;
 	struct mutex		zlib_workspace_lock;
 	mempool_t		compression_bounce[2];
 
+	/* compression heuristic counters, see compress.c: */
+	atomic64_t		compress_attempted;
+	atomic64_t		compress_wasted;
+	atomic64_t		compress_skipped_entropy;
+	atomic64_t		compress_skipped_backoff;
+	atomic64_t		decompress_direct;
+	atomic64_t		decompress_bounced;
+
 	struct crypto_blkcipher	*chacha20;
 	struct crypto_shash	*poly1305;
 
@@ -89,11 +89,103 @@ static struct btree *mca_bucket_alloc(struct bch_fs *c, gfp_t gfp)
 	six_lock_init(&b->lock);
 	INIT_LIST_HEAD(&b->list);
 	INIT_LIST_HEAD(&b->write_blocked);
+	b->lru = BTREE_LRU_NONE;
 
 	mca_data_alloc(c, b, gfp);
 	return b->data ? b : NULL;
 }
 
+/*
+ * Btree in memory cache - replacement policy
+ *
+ * This is CAR (CLOCK with Adaptive Replacement, a variant of ARC): nodes that
+ * are read in go on the recent list, and are only moved to the frequent list if
+ * they're used again while they're still cached. A single pass over the whole
+ * btree - gc, fsck - just cycles nodes through the recent list, instead of
+ * evicting the interior nodes and hot leaves that foreground lookups depend on.
+ *
+ * Lookups only set BTREE_NODE_accessed; nodes are promoted (or, on the frequent
+ * list, given a second chance) when the clock hand reaches the tail of their
+ * list. Iterators that are walking the btree sequentially (iter->readahead is
+ * set) don't set BTREE_NODE_accessed and don't check the ghost entries, so
+ * that running the same scan twice doesn't promote everything it touched.
+ *
+ * When we evict a node we remember it in btree_cache_ghosts - a direct mapped
+ * table, so it's only approximately the most recently evicted nodes. If we
+ * read in a node that was recently evicted from the recent list, the recent
+ * list should have been bigger, and if it was evicted from the frequent list
+ * the frequent list should have been bigger: btree_cache_recent_target is
+ * adjusted accordingly, and either way the node goes straight onto the
+ * frequent list.
+ */
+
+#define BTREE_CACHE_GHOST_BITS	10
+
+static void mca_lru_add(struct bch_fs *c, struct btree *b, enum btree_lru lru)
+{
+	BUG_ON(b->lru != BTREE_LRU_NONE);
+
+	b->lru = lru;
+	c->btree_cache_lru_nr[lru]++;
+	list_add(&b->list, &c->btree_cache_lru[lru]);
+}
+
+void mca_lru_del(struct bch_fs *c, struct btree *b)
+{
+	lockdep_assert_held(&c->btree_cache_lock);
+
+	if (b->lru != BTREE_LRU_NONE) {
+		c->btree_cache_lru_nr[b->lru]--;
+		b->lru = BTREE_LRU_NONE;
+	}
+
+	list_del_init(&b->list);
+}
+
+static inline struct btree_cache_ghost *mca_ghost(struct bch_fs *c, u64 ptr)
+{
+	return c->btree_cache_ghosts + hash_64(ptr, BTREE_CACHE_GHOST_BITS);
+}
+
+static void mca_ghost_add(struct bch_fs *c, struct btree *b)
+{
+	struct btree_cache_ghost *g = mca_ghost(c, PTR_HASH(&b->key));
+
+	if (g->ptr)
+		c->btree_cache_ghosts_nr[g->lru]--;
+
+	g->ptr	= PTR_HASH(&b->key);
+	g->lru	= b->lru;
+	c->btree_cache_ghosts_nr[g->lru]++;
+}
+
+/* Returns the lru list a node that's being read in should go on: */
+static enum btree_lru mca_ghost_hit(struct bch_fs *c, struct btree *b)
+{
+	struct btree_cache_ghost *g = mca_ghost(c, PTR_HASH(&b->key));
+	unsigned *nr = c->btree_cache_ghosts_nr;
+	unsigned *target = &c->btree_cache_recent_target;
+	unsigned cached = c->btree_cache_lru_nr[BTREE_LRU_RECENT] +
+		c->btree_cache_lru_nr[BTREE_LRU_FREQUENT];
+
+	if (g->ptr != PTR_HASH(&b->key))
+		return BTREE_LRU_RECENT;
+
+	if (g->lru == BTREE_LRU_RECENT)
+		*target = min(*target + max(1U, nr[BTREE_LRU_FREQUENT] /
+					    max(1U, nr[BTREE_LRU_RECENT])),
+			      cached);
+	else
+		*target -= min(*target, max(1U, nr[BTREE_LRU_RECENT] /
+					    max(1U, nr[BTREE_LRU_FREQUENT])));
+
+	c->btree_cache_ghost_hits[g->lru]++;
+	c->btree_cache_ghosts_nr[g->lru]--;
+	g->ptr = 0;
+
+	return BTREE_LRU_FREQUENT;
+}
+
 /* Btree in memory cache - hash table */
 
 void mca_hash_remove(struct bch_fs *c, struct btree *b)
@@ -109,8 +201,9 @@ void mca_hash_remove(struct bch_fs *c, struct btree *b)
 	bkey_i_to_extent(&b->key)->v._data[0] = 0;
 }
 
-int mca_hash_insert(struct bch_fs *c, struct btree *b,
-		    unsigned level, enum btree_id id)
+static int __mca_hash_insert(struct bch_fs *c, struct btree *b,
+			     unsigned level, enum btree_id id,
+			     bool sequential)
 {
 	int ret;
 	b->level	= level;
@@ -122,12 +215,20 @@ int mca_hash_insert(struct bch_fs *c, struct btree *b,
 		return ret;
 
 	mutex_lock(&c->btree_cache_lock);
-	list_add(&b->list, &c->btree_cache);
+	mca_lru_add(c, b, sequential
+		    ? BTREE_LRU_RECENT
+		    : mca_ghost_hit(c, b));
 	mutex_unlock(&c->btree_cache_lock);
 
 	return 0;
 }
 
+int mca_hash_insert(struct bch_fs *c, struct btree *b,
+		    unsigned level, enum btree_id id)
+{
+	return __mca_hash_insert(c, b, level, id, false);
+}
+
 __flatten
 static inline struct btree *mca_find(struct bch_fs *c,
 				     const struct bkey_i *k)
@@ -195,6 +296,52 @@ static int mca_reap(struct bch_fs *c, struct btree *b, bool flush)
 	return ret;
 }
 
+/*
+ * Advance the clock hand by one node: returns the node under the hand if it
+ * could be reaped - taken off the lru, and locked - or NULL if it was promoted
+ * or couldn't be reaped.
+ */
+static struct btree *mca_clock_step(struct bch_fs *c)
+{
+	enum btree_lru lru =
+		c->btree_cache_lru_nr[BTREE_LRU_RECENT] >
+		c->btree_cache_recent_target ||
+		list_empty(&c->btree_cache_lru[BTREE_LRU_FREQUENT])
+		? BTREE_LRU_RECENT
+		: BTREE_LRU_FREQUENT;
+	struct list_head *list = &c->btree_cache_lru[lru];
+	struct btree *b;
+
+	lockdep_assert_held(&c->btree_cache_lock);
+
+	if (list_empty(list))
+		return NULL;
+
+	b = list_last_entry(list, struct btree, list);
+
+	if (btree_node_accessed(b)) {
+		clear_btree_node_accessed(b);
+
+		if (lru == BTREE_LRU_RECENT)
+			c->btree_cache_promoted++;
+
+		mca_lru_del(c, b);
+		mca_lru_add(c, b, BTREE_LRU_FREQUENT);
+		return NULL;
+	}
+
+	if (mca_reap(c, b, false)) {
+		/* Locked, or dirty - skip it for now: */
+		list_move(&b->list, list);
+		return NULL;
+	}
+
+	c->btree_cache_evicted[lru]++;
+	mca_ghost_add(c, b);
+	mca_lru_del(c, b);
+	return b;
+}
+
 static unsigned long bch_mca_scan(struct shrinker *shrink,
 				  struct shrink_control *sc)
 {
@@ -205,7 +352,7 @@ static unsigned long bch_mca_scan(struct shrinker *shrink,
 	unsigned long can_free;
 	unsigned long touched = 0;
 	unsigned long freed = 0;
-	unsigned i;
+	unsigned i, clock_steps;
 
 	u64 start_time = local_clock();
 
@@ -247,41 +394,37 @@ static unsigned long bch_mca_scan(struct shrinker *shrink,
 			freed++;
 		}
 	}
-restart:
-	list_for_each_entry_safe(b, t, &c->btree_cache, list) {
-		touched++;
 
-		if (freed >= nr) {
-			/* Save position */
-			if (&t->list != &c->btree_cache)
-				list_move_tail(&c->btree_cache, &t->list);
-			break;
-		}
+	/*
+	 * Enough steps to go all the way around once, promoting nodes as we
+	 * go, and then once more:
+	 */
+	clock_steps = 2 * (c->btree_cache_lru_nr[BTREE_LRU_RECENT] +
+			   c->btree_cache_lru_nr[BTREE_LRU_FREQUENT]);
 
-		if (!btree_node_accessed(b) &&
-		    !mca_reap(c, b, false)) {
-			/* can't call mca_hash_remove under btree_cache_lock  */
-			freed++;
-			if (&t->list != &c->btree_cache)
-				list_move_tail(&c->btree_cache, &t->list);
+	while (freed < nr && clock_steps--) {
+		touched++;
 
-			mca_data_free(c, b);
-			mutex_unlock(&c->btree_cache_lock);
+		b = mca_clock_step(c);
+		if (!b)
+			continue;
 
-			mca_hash_remove(c, b);
-			six_unlock_write(&b->lock);
-			six_unlock_intent(&b->lock);
+		/* can't call mca_hash_remove under btree_cache_lock  */
+		freed++;
+		mca_data_free(c, b);
+		mutex_unlock(&c->btree_cache_lock);
 
-			if (freed >= nr)
-				goto out;
+		mca_hash_remove(c, b);
+		six_unlock_write(&b->lock);
+		six_unlock_intent(&b->lock);
+
+		if (freed >= nr)
+			goto out;
 
-			if (sc->gfp_mask & __GFP_IO)
-				mutex_lock(&c->btree_cache_lock);
-			else if (!mutex_trylock(&c->btree_cache_lock))
-				goto out;
-			goto restart;
-		} else
-			clear_btree_node_accessed(b);
+		if (sc->gfp_mask & __GFP_IO)
+			mutex_lock(&c->btree_cache_lock);
+		else if (!mutex_trylock(&c->btree_cache_lock))
+			goto out;
 	}
 
 	mutex_unlock(&c->btree_cache_lock);
@@ -312,6 +455,46 @@ static unsigned long bch_mca_count(struct shrinker *shrink,
 	return mca_can_free(c) * btree_pages(c);
 }
 
+/*
+ * In userspace nothing calls the shrinker, so if the btree_cache_size option
+ * was given we call it ourselves before allocating memory for another node.
+ * It's a soft limit - the shrinker can't evict nodes that are dirty or locked,
+ * or go below the reserve - so we also try again when btree node writes
+ * complete, from btree_cache_limit_work:
+ */
+static unsigned mca_over_limit(struct bch_fs *c, unsigned nr_new)
+{
+	u64 limit = c->opts.btree_cache_size / btree_bytes(c);
+
+	return c->opts.btree_cache_size &&
+		c->btree_cache_used + nr_new > limit
+		? c->btree_cache_used + nr_new - limit
+		: 0;
+}
+
+void mca_shrink_to_limit(struct bch_fs *c, unsigned nr_new)
+{
+	struct shrink_control sc = { .gfp_mask = GFP_KERNEL };
+
+	sc.nr_to_scan = mca_over_limit(c, nr_new) * btree_pages(c);
+	if (sc.nr_to_scan)
+		bch_mca_scan(&c->btree_cache_shrink, &sc);
+}
+
+void mca_shrink_to_limit_async(struct bch_fs *c)
+{
+	if (mca_over_limit(c, 0))
+		queue_work(system_unbound_wq, &c->btree_cache_limit_work);
+}
+
+void bch_btree_cache_limit_work(struct work_struct *work)
+{
+	struct bch_fs *c = container_of(work, struct bch_fs,
+					btree_cache_limit_work);
+
+	mca_shrink_to_limit(c, 0);
+}
+
 void bch_fs_btree_exit(struct bch_fs *c)
 {
 	struct btree *b;
@@ -324,20 +507,25 @@ void bch_fs_btree_exit(struct bch_fs *c)
 
 #ifdef CONFIG_BCACHE_DEBUG
 	if (c->verify_data)
-		list_move(&c->verify_data->list, &c->btree_cache);
+		list_move(&c->verify_data->list, &c->btree_cache_freeable);
 
 	free_pages((unsigned long) c->verify_ondisk, ilog2(btree_pages(c)));
 #endif
 
 	for (i = 0; i < BTREE_ID_NR; i++)
 		if (c->btree_roots[i].b)
-			list_add(&c->btree_roots[i].b->list, &c->btree_cache);
+			list_add(&c->btree_roots[i].b->list,
+				 &c->btree_cache_freeable);
 
-	list_splice(&c->btree_cache_freeable,
-		    &c->btree_cache);
+	for (i = 0; i < BTREE_LRU_NR; i++) {
+		list_splice_init(&c->btree_cache_lru[i],
+				 &c->btree_cache_freeable);
+		c->btree_cache_lru_nr[i] = 0;
+	}
 
-	while (!list_empty(&c->btree_cache)) {
-		b = list_first_entry(&c->btree_cache, struct btree, list);
+	while (!list_empty(&c->btree_cache_freeable)) {
+		b = list_first_entry(&c->btree_cache_freeable,
+				     struct btree, list);
 
 		if (btree_node_dirty(b))
 			bch_btree_complete_write(c, b, btree_current_write(b));
@@ -355,6 +543,8 @@ void bch_fs_btree_exit(struct bch_fs *c)
 
 	mutex_unlock(&c->btree_cache_lock);
 
+	kfree(c->btree_cache_ghosts);
+
 	if (c->btree_cache_table_init_done)
 		rhashtable_destroy(&c->btree_cache_table);
 }
@@ -370,15 +560,18 @@ int bch_fs_btree_init(struct bch_fs *c)
 
 	c->btree_cache_table_init_done = true;
 
+	c->btree_cache_ghosts = kcalloc(1 << BTREE_CACHE_GHOST_BITS,
+					sizeof(struct btree_cache_ghost),
+					GFP_KERNEL);
+	if (!c->btree_cache_ghosts)
+		return -ENOMEM;
+
 	bch_recalc_btree_reserve(c);
 
 	for (i = 0; i < c->btree_cache_reserve; i++)
 		if (!mca_bucket_alloc(c, GFP_KERNEL))
 			return -ENOMEM;
 
-	list_splice_init(&c->btree_cache,
-			 &c->btree_cache_freeable);
-
 #ifdef CONFIG_BCACHE_DEBUG
 	mutex_init(&c->verify_lock);
 
@@ -452,15 +645,24 @@ success:
 static struct btree *mca_cannibalize(struct bch_fs *c)
 {
 	struct btree *b;
+	unsigned i, clock_steps = 2 * (c->btree_cache_lru_nr[BTREE_LRU_RECENT] +
+				       c->btree_cache_lru_nr[BTREE_LRU_FREQUENT]);
 
-	list_for_each_entry_reverse(b, &c->btree_cache, list)
-		if (!mca_reap(c, b, false))
+	while (clock_steps--) {
+		b = mca_clock_step(c);
+		if (b)
 			return b;
+	}
 
 	while (1) {
-		list_for_each_entry_reverse(b, &c->btree_cache, list)
-			if (!mca_reap(c, b, true))
-				return b;
+		for (i = 0; i < BTREE_LRU_NR; i++)
+			list_for_each_entry_reverse(b, &c->btree_cache_lru[i], list)
+				if (!mca_reap(c, b, true)) {
+					c->btree_cache_evicted[i]++;
+					mca_ghost_add(c, b);
+					mca_lru_del(c, b);
+					return b;
+				}
 
 		/*
 		 * Rare case: all nodes were intent-locked.
@@ -476,6 +678,8 @@ struct btree *mca_alloc(struct bch_fs *c)
 	struct btree *b;
 	u64 start_time = local_clock();
 
+	mca_shrink_to_limit(c, 1);
+
 	mutex_lock(&c->btree_cache_lock);
 
 	/*
@@ -547,7 +751,8 @@ err:
 static noinline struct btree *bch_btree_node_fill(struct btree_iter *iter,
 						  const struct bkey_i *k,
 						  unsigned level,
-						  enum six_lock_type lock_type)
+						  enum six_lock_type lock_type,
+						  bool sync)
 {
 	struct bch_fs *c = iter->c;
 	struct btree *b;
@@ -557,7 +762,7 @@ static noinline struct btree *bch_btree_node_fill(struct btree_iter *iter,
 		return b;
 
 	bkey_copy(&b->key, k);
-	if (mca_hash_insert(c, b, level, iter->btree_id)) {
+	if (__mca_hash_insert(c, b, level, iter->btree_id, iter->readahead)) {
 		/* raced with another fill: */
 
 		/* mark as unhashed... */
@@ -572,6 +777,17 @@ static noinline struct btree *bch_btree_node_fill(struct btree_iter *iter,
 		return NULL;
 	}
 
+	if (!sync) {
+		set_btree_node_readahead(b);
+		atomic64_inc(&c->btree_readahead_reads);
+
+		/* the read completion unlocks the node: */
+		bch_btree_node_read(c, b, false);
+		return NULL;
+	}
+
+	atomic64_inc(&c->btree_cache_misses);
+
 	/*
 	 * If the btree node wasn't cached, we can't drop our lock on
 	 * the parent until after it's added to the cache - because
@@ -584,7 +800,7 @@ static noinline struct btree *bch_btree_node_fill(struct btree_iter *iter,
 	if (btree_node_read_locked(iter, level + 1))
 		btree_node_unlock(iter, level + 1);
 
-	bch_btree_node_read(c, b);
+	bch_btree_node_read(c, b, true);
 	six_unlock_write(&b->lock);
 
 	if (lock_type == SIX_LOCK_read)
@@ -621,7 +837,7 @@ retry:
 		 * else we could read in a btree node from disk that's been
 		 * freed:
 		 */
-		b = bch_btree_node_fill(iter, k, level, lock_type);
+		b = bch_btree_node_fill(iter, k, level, lock_type, true);
 
 		/* We raced and found the btree node in the cache */
 		if (!b)
@@ -673,6 +889,20 @@ retry:
 
 			return ERR_PTR(-EINTR);
 		}
+
+		atomic64_inc(&iter->c->btree_cache_hits);
+
+		if (unlikely(btree_node_readahead(b)) &&
+		    test_and_clear_bit(BTREE_NODE_readahead, &b->flags))
+			atomic64_inc(&iter->c->btree_readahead_hits);
+
+		/*
+		 * Sequential scans don't count as accesses for the replacement
+		 * policy - avoid atomic set bit if it's not needed:
+		 */
+		if (!iter->readahead &&
+		    !btree_node_accessed(b))
+			set_btree_node_accessed(b);
 	}
 
 	prefetch(b->aux_data);
@@ -685,10 +915,6 @@ retry:
 		prefetch(p + L1_CACHE_BYTES * 2);
 	}
 
-	/* avoid atomic set bit if it's not needed: */
-	if (btree_node_accessed(b))
-		set_btree_node_accessed(b);
-
 	if (unlikely(btree_node_read_error(b))) {
 		six_unlock_type(&b->lock, lock_type);
 		return ERR_PTR(-EIO);
@@ -702,6 +928,127 @@ retry:
 	return b;
 }
 
+/**
+ * bch_btree_node_prefetch - start reading a btree node into the btree cache,
+ * if it isn't already cached
+ *
+ * Like bch_btree_node_fill(), the parent node must be locked. Doesn't wait for
+ * the read: returns false if there wasn't memory for the node, so callers can
+ * stop issuing readahead.
+ */
+bool bch_btree_node_prefetch(struct btree_iter *iter,
+			     const struct bkey_i *k, unsigned level)
+{
+	struct btree *b;
+
+	BUG_ON(level >= BTREE_MAX_DEPTH);
+
+	rcu_read_lock();
+	b = mca_find(iter->c, k);
+	rcu_read_unlock();
+
+	if (b)
+		return true;
+
+	b = bch_btree_node_fill(iter, k, level, SIX_LOCK_read, false);
+	return !IS_ERR(b);
+}
+
+/**
+ * bch_btree_node_get_unlinked - find a btree node that isn't reachable from a
+ * btree root, and read lock it, reading it in from disk if necessary
+ *
+ * For nodes written by a bulk load: there's no parent node to lock, so the
+ * caller must ensure the node can't be freed while we're looking it up.
+ */
+struct btree *bch_btree_node_get_unlinked(struct bch_fs *c,
+					  const struct bkey_i *k,
+					  unsigned level, enum btree_id id)
+{
+	struct btree *b;
+retry:
+	rcu_read_lock();
+	b = mca_find(c, k);
+	rcu_read_unlock();
+
+	if (b) {
+		six_lock_read(&b->lock);
+
+		if (unlikely(PTR_HASH(&b->key) != PTR_HASH(k))) {
+			six_unlock_read(&b->lock);
+			goto retry;
+		}
+	} else {
+		b = mca_alloc(c);
+		if (IS_ERR(b))
+			return b;
+
+		bkey_copy(&b->key, k);
+		if (mca_hash_insert(c, b, level, id)) {
+			/* raced with another fill: */
+			bkey_i_to_extent(&b->key)->v._data[0] = 0;
+
+			mutex_lock(&c->btree_cache_lock);
+			list_add(&b->list, &c->btree_cache_freeable);
+			mutex_unlock(&c->btree_cache_lock);
+
+			six_unlock_write(&b->lock);
+			six_unlock_intent(&b->lock);
+			goto retry;
+		}
+
+		bch_btree_node_read(c, b, true);
+		six_unlock_write(&b->lock);
+		six_lock_downgrade(&b->lock);
+	}
+
+	if (btree_node_read_error(b)) {
+		six_unlock_read(&b->lock);
+		return ERR_PTR(-EIO);
+	}
+
+	return b;
+}
+
+/**
+ * bch_btree_node_evict - drop the node @k points to from the btree cache
+ *
+ * For freeing nodes that were written but never made reachable; writes to the
+ * node must have completed.
+ */
+void bch_btree_node_evict(struct bch_fs *c, const struct bkey_i *k)
+{
+	struct btree *b;
+retry:
+	rcu_read_lock();
+	b = mca_find(c, k);
+	rcu_read_unlock();
+
+	if (!b)
+		return;
+
+	six_lock_intent(&b->lock);
+	six_lock_write(&b->lock);
+
+	if (unlikely(PTR_HASH(&b->key) != PTR_HASH(k))) {
+		six_unlock_write(&b->lock);
+		six_unlock_intent(&b->lock);
+		goto retry;
+	}
+
+	BUG_ON(btree_node_write_in_flight(b));
+
+	mca_hash_remove(c, b);
+
+	mutex_lock(&c->btree_cache_lock);
+	mca_lru_del(c, b);
+	list_add(&b->list, &c->btree_cache_freeable);
+	mutex_unlock(&c->btree_cache_lock);
+
+	six_unlock_write(&b->lock);
+	six_unlock_intent(&b->lock);
+}
+
 int bch_print_btree_node(struct bch_fs *c, struct btree *b,
 			 char *buf, size_t len)
 {
@@ -754,3 +1101,41 @@ int bch_print_btree_node(struct bch_fs *c, struct btree *b,
 			 stats.failed_prev,
 			 stats.failed_overflow);
 }
+
+int bch_print_btree_cache_stats(struct bch_fs *c, char *buf, size_t len)
+{
+	int ret;
+
+	mutex_lock(&c->btree_cache_lock);
+	ret = scnprintf(buf, len,
+			"nodes recent:		%u (target %u)\n"
+			"nodes frequent:		%u\n"
+			"ghosts recent:		%u\n"
+			"ghosts frequent:	%u\n"
+			"hits:			%llu\n"
+			"misses (sync reads):	%llu\n"
+			"readahead reads:	%llu\n"
+			"readahead hits:		%llu\n"
+			"promoted:		%llu\n"
+			"evicted recent:		%llu\n"
+			"evicted frequent:	%llu\n"
+			"ghost hits recent:	%llu\n"
+			"ghost hits frequent:	%llu\n",
+			c->btree_cache_lru_nr[BTREE_LRU_RECENT],
+			c->btree_cache_recent_target,
+			c->btree_cache_lru_nr[BTREE_LRU_FREQUENT],
+			c->btree_cache_ghosts_nr[BTREE_LRU_RECENT],
+			c->btree_cache_ghosts_nr[BTREE_LRU_FREQUENT],
+			(u64) atomic64_read(&c->btree_cache_hits),
+			(u64) atomic64_read(&c->btree_cache_misses),
+			(u64) atomic64_read(&c->btree_readahead_reads),
+			(u64) atomic64_read(&c->btree_readahead_hits),
+			c->btree_cache_promoted,
+			c->btree_cache_evicted[BTREE_LRU_RECENT],
+			c->btree_cache_evicted[BTREE_LRU_FREQUENT],
+			c->btree_cache_ghost_hits[BTREE_LRU_RECENT],
+			c->btree_cache_ghost_hits[BTREE_LRU_FREQUENT]);
+	mutex_unlock(&c->btree_cache_lock);
+
+	return ret;
+}
@@ -10,6 +10,11 @@ extern const char * const bch_btree_ids[];
 
 void bch_recalc_btree_reserve(struct bch_fs *);
 
+void mca_lru_del(struct bch_fs *, struct btree *);
+void mca_shrink_to_limit(struct bch_fs *, unsigned);
+void mca_shrink_to_limit_async(struct bch_fs *);
+void bch_btree_cache_limit_work(struct work_struct *);
+
 void mca_hash_remove(struct bch_fs *, struct btree *);
 int mca_hash_insert(struct bch_fs *, struct btree *,
 		    unsigned, enum btree_id);
@@ -21,6 +26,12 @@ struct btree *mca_alloc(struct bch_fs *);
 
 struct btree *bch_btree_node_get(struct btree_iter *, const struct bkey_i *,
 				 unsigned, enum six_lock_type);
+bool bch_btree_node_prefetch(struct btree_iter *, const struct bkey_i *,
+			     unsigned);
+struct btree *bch_btree_node_get_unlinked(struct bch_fs *,
+					  const struct bkey_i *,
+					  unsigned, enum btree_id);
+void bch_btree_node_evict(struct bch_fs *, const struct bkey_i *);
 
 void bch_fs_btree_exit(struct bch_fs *);
 int bch_fs_btree_init(struct bch_fs *);
@@ -67,5 +78,6 @@ static inline unsigned btree_blocks(struct bch_fs *c)
 
 int bch_print_btree_node(struct bch_fs *, struct btree *,
 			 char *, size_t);
+int bch_print_btree_cache_stats(struct bch_fs *, char *, size_t);
 
 #endif /* _BCACHE_BTREE_CACHE_H */
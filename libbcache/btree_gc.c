@@ -6,6 +6,7 @@
 #include "bcache.h"
 #include "alloc.h"
 #include "bkey_methods.h"
+#include "btree_cache.h"
 #include "btree_locking.h"
 #include "btree_update.h"
 #include "btree_io.h"
@@ -357,6 +358,45 @@ static void bch_mark_pending_btree_node_frees(struct bch_fs *c)
 	mutex_unlock(&c->btree_interior_update_lock);
 }
 
+/*
+ * Nodes written by a bulk load aren't reachable until the load finishes: mark
+ * them, and the keys the load has buffered. Bulk loads only add to these with
+ * gc_lock held, so they can't race with us:
+ */
+static int bch_mark_bulk_loads(struct bch_fs *c)
+{
+	struct btree_bulk_load *l;
+	struct bkey_i *k;
+	struct btree *b;
+	unsigned level;
+
+	list_for_each_entry(l, &c->btree_bulk_loads, list) {
+		for (level = 0; level < BTREE_MAX_DEPTH; level++)
+			for_each_keylist_key(&l->level[level].nodes, k) {
+				bch_btree_mark_key(c, BKEY_TYPE_BTREE,
+						   bkey_i_to_s_c(k));
+
+				if (level || !btree_type_has_ptrs(l->btree_id))
+					continue;
+
+				b = bch_btree_node_get_unlinked(c, k, 0,
+								l->btree_id);
+				if (IS_ERR(b))
+					return PTR_ERR(b);
+
+				btree_gc_mark_node(c, b);
+				six_unlock_read(&b->lock);
+			}
+
+		if (btree_type_has_ptrs(l->btree_id))
+			for_each_keylist_key(&l->level[0].keys, k)
+				bch_btree_mark_key(c, l->btree_id,
+						   bkey_i_to_s_c(k));
+	}
+
+	return 0;
+}
+
 /**
  * bch_gc - recompute bucket marks and oldest_gen, rewrite btree nodes
  */
@@ -367,7 +407,7 @@ void bch_gc(struct bch_fs *c)
 	struct bucket_mark new;
 	u64 start_time = local_clock();
 	unsigned i;
-	int cpu;
+	int cpu, ret;
 
 	/*
 	 * Walk _all_ references to buckets, and recompute them:
@@ -447,7 +487,7 @@ void bch_gc(struct bch_fs *c)
 
 	/* Walk btree: */
 	while (c->gc_pos.phase < (int) BTREE_ID_NR) {
-		int ret = c->btree_roots[c->gc_pos.phase].b
+		ret = c->btree_roots[c->gc_pos.phase].b
 			? bch_gc_btree(c, (int) c->gc_pos.phase)
 			: 0;
 
@@ -461,6 +501,14 @@ void bch_gc(struct bch_fs *c)
 		gc_pos_set(c, gc_phase(c->gc_pos.phase + 1));
 	}
 
+	ret = bch_mark_bulk_loads(c);
+	if (ret) {
+		bch_err(c, "btree gc failed marking bulk loads: %d", ret);
+		set_bit(BCH_FS_GC_FAILURE, &c->flags);
+		up_write(&c->gc_lock);
+		return;
+	}
+
 	bch_mark_metadata(c);
 	bch_mark_pending_btree_node_frees(c);
 	bch_writeback_recalc_oldest_gens(c);
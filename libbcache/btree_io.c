@@ -1177,14 +1177,58 @@ err:
 	goto out;
 }
 
+static void btree_node_read_complete(struct btree_read_bio *rb)
+{
+	struct bch_fs *c = rb->c;
+	struct btree *b = rb->b;
+
+	if (bch_dev_fatal_io_err_on(rb->bio.bi_error,
+				  rb->ca, "IO error reading bucket %zu",
+				  PTR_BUCKET_NR(rb->ca, &rb->ptr)) ||
+	    bch_meta_read_fault("btree")) {
+		set_btree_node_read_error(b);
+		return;
+	}
+
+	bch_btree_node_read_done(c, b, rb->ca, &rb->ptr);
+	bch_time_stats_update(&c->btree_read_time, rb->start_time);
+}
+
+static void btree_node_read_work(struct work_struct *work)
+{
+	struct btree_read_bio *rb =
+		container_of(work, struct btree_read_bio, work);
+	struct btree *b = rb->b;
+	struct bch_dev *ca = rb->ca;
+
+	btree_node_read_complete(rb);
+	bio_put(&rb->bio);
+
+	six_unlock_write(&b->lock);
+	six_unlock_intent(&b->lock);
+
+	percpu_ref_put(&ca->io_ref);
+}
+
 static void btree_node_read_endio(struct bio *bio)
 {
-	closure_put(bio->bi_private);
+	struct btree_read_bio *rb =
+		container_of(bio, struct btree_read_bio, bio);
+
+	if (rb->cl)
+		closure_put(rb->cl);
+	else
+		queue_work(system_unbound_wq, &rb->work);
 }
 
-void bch_btree_node_read(struct bch_fs *c, struct btree *b)
+/*
+ * With @sync false, this is readahead: @b must be intent and write locked, and
+ * it's unlocked when the read completes - anyone who finds @b in the btree
+ * cache in the meantime blocks on its lock until it's been read in:
+ */
+void bch_btree_node_read(struct bch_fs *c, struct btree *b, bool sync)
 {
-	uint64_t start_time = local_clock();
+	struct btree_read_bio *rb;
 	struct closure cl;
 	struct bio *bio;
 	struct extent_pick_ptr pick;
@@ -1197,34 +1241,42 @@ void bch_btree_node_read(struct bch_fs *c, struct btree *b)
 	if (bch_fs_fatal_err_on(!pick.ca, c,
 				"no cache device for btree node")) {
 		set_btree_node_read_error(b);
+		if (!sync) {
+			six_unlock_write(&b->lock);
+			six_unlock_intent(&b->lock);
+		}
 		return;
 	}
 
 	bio = bio_alloc_bioset(GFP_NOIO, btree_pages(c), &c->btree_read_bio);
+	rb = container_of(bio, struct btree_read_bio, bio);
+	rb->c			= c;
+	rb->b			= b;
+	rb->ca			= pick.ca;
+	rb->ptr			= pick.ptr;
+	rb->start_time		= local_clock();
+	rb->cl			= sync ? &cl : NULL;
+	INIT_WORK(&rb->work, btree_node_read_work);
+
 	bio->bi_bdev		= pick.ca->disk_sb.bdev;
 	bio->bi_iter.bi_sector	= pick.ptr.offset;
 	bio->bi_iter.bi_size	= btree_bytes(c);
 	bio->bi_end_io		= btree_node_read_endio;
-	bio->bi_private		= &cl;
-	bio_set_op_attrs(bio, REQ_OP_READ, REQ_META|READ_SYNC);
+	bio_set_op_attrs(bio, REQ_OP_READ,
+			 REQ_META|(sync ? READ_SYNC : REQ_RAHEAD));
 
 	bch_bio_map(bio, b->data);
 
+	if (!sync) {
+		bch_generic_make_request(bio, c);
+		return;
+	}
+
 	closure_get(&cl);
 	bch_generic_make_request(bio, c);
 	closure_sync(&cl);
 
-	if (bch_dev_fatal_io_err_on(bio->bi_error,
-				  pick.ca, "IO error reading bucket %zu",
-				  PTR_BUCKET_NR(pick.ca, &pick.ptr)) ||
-	    bch_meta_read_fault("btree")) {
-		set_btree_node_read_error(b);
-		goto out;
-	}
-
-	bch_btree_node_read_done(c, b, pick.ca, &pick.ptr);
-	bch_time_stats_update(&c->btree_read_time, start_time);
-out:
+	btree_node_read_complete(rb);
 	bio_put(bio);
 	percpu_ref_put(&pick.ca->io_ref);
 }
@@ -1251,7 +1303,7 @@ int bch_btree_root_read(struct bch_fs *c, enum btree_id id,
 	bkey_copy(&b->key, k);
 	BUG_ON(mca_hash_insert(c, b, level, id));
 
-	bch_btree_node_read(c, b);
+	bch_btree_node_read(c, b, true);
 	six_unlock_write(&b->lock);
 
 	if (btree_node_read_error(b)) {
@@ -1286,6 +1338,9 @@ static void btree_node_write_done(struct bch_fs *c, struct btree *b)
 
 	bch_btree_complete_write(c, b, w);
 	btree_node_io_unlock(b);
+
+	/* The node can be evicted now, if we're over the cache size limit: */
+	mca_shrink_to_limit_async(c);
 }
 
 static void btree_node_write_endio(struct bio *bio)
@@ -1664,6 +1719,7 @@ static void bch_btree_node_write_dirty(struct bch_fs *c, struct btree *b,
 void bch_btree_flush(struct bch_fs *c)
 {
 	struct closure cl;
+	struct blk_plug plug;
 	struct btree *b;
 	struct bucket_table *tbl;
 	struct rhash_head *pos;
@@ -1671,6 +1727,7 @@ void bch_btree_flush(struct bch_fs *c)
 	unsigned i;
 
 	closure_init_stack(&cl);
+	blk_start_plug(&plug);
 
 	rcu_read_lock();
 
@@ -1698,6 +1755,7 @@ restart:
 
 	rcu_read_unlock();
 
+	blk_finish_plug(&plug);
 	closure_sync(&cl);
 }
 
@@ -6,6 +6,21 @@ struct btree_write;
 struct btree;
 struct btree_iter;
 
+struct btree_read_bio {
+	struct bch_fs		*c;
+	struct btree		*b;
+	struct bch_dev		*ca;
+	struct bch_extent_ptr	ptr;
+	u64			start_time;
+
+	/* NULL for readahead, which completes (and unlocks @b) from @work: */
+	struct closure		*cl;
+	struct work_struct	work;
+
+	/* Must be last: */
+	struct bio		bio;
+};
+
 static inline void btree_node_io_unlock(struct btree *b)
 {
 	EBUG_ON(!btree_node_write_in_flight(b));
@@ -52,7 +67,7 @@ void bch_btree_init_next(struct bch_fs *, struct btree *,
 
 void bch_btree_node_read_done(struct bch_fs *, struct btree *,
 			      struct bch_dev *, const struct bch_extent_ptr *);
-void bch_btree_node_read(struct bch_fs *, struct btree *);
+void bch_btree_node_read(struct bch_fs *, struct btree *, bool);
 int bch_btree_root_read(struct bch_fs *, enum btree_id,
 			const struct bkey_i *, unsigned);
 
@@ -711,6 +711,38 @@ static inline int btree_iter_lock_root(struct btree_iter *iter,
 	}
 }
 
+/*
+ * Start reading in the children of the node at iter->level that come after the
+ * one we're descending into - they're read asynchronously into the btree cache,
+ * and the parent must still be locked:
+ */
+static noinline void btree_iter_readahead(struct btree_iter *iter)
+{
+	struct btree *b = iter->nodes[iter->level];
+	struct btree_node_iter node_iter = iter->node_iters[iter->level];
+	struct bkey_packed *k;
+	struct blk_plug plug;
+	unsigned nr = iter->c->opts.btree_readahead;
+	BKEY_PADDED(k) tmp;
+
+	bch_btree_node_iter_advance(&node_iter, b);
+
+	/* siblings are usually adjacent on disk, let the reads be merged: */
+	blk_start_plug(&plug);
+
+	while (nr-- &&
+	       (k = bch_btree_node_iter_peek(&node_iter, b))) {
+		bkey_unpack(b, &tmp.k, k);
+
+		if (!bch_btree_node_prefetch(iter, &tmp.k, iter->level - 1))
+			break;
+
+		bch_btree_node_iter_advance(&node_iter, b);
+	}
+
+	blk_finish_plug(&plug);
+}
+
 static inline int btree_iter_down(struct btree_iter *iter)
 {
 	struct btree *b;
@@ -721,6 +753,10 @@ static inline int btree_iter_down(struct btree_iter *iter)
 
 	bkey_reassemble(&tmp.k, k);
 
+	if (unlikely(iter->readahead) &&
+	    iter->c->opts.btree_readahead > 0)
+		btree_iter_readahead(iter);
+
 	b = bch_btree_node_get(iter, &tmp.k, level, lock_type);
 	if (unlikely(IS_ERR(b)))
 		return PTR_ERR(b);
@@ -952,6 +988,7 @@ struct btree *bch_btree_iter_next_node(struct btree_iter *iter, unsigned depth)
 			? btree_type_successor(iter->btree_id, iter->pos)
 			: bkey_successor(iter->pos);
 		iter->level	= depth;
+		iter->readahead	= true;
 
 		ret = bch_btree_iter_traverse(iter);
 		if (ret)
@@ -993,6 +1030,7 @@ void bch_btree_iter_set_pos_same_leaf(struct btree_iter *iter, struct bpos new_p
 void bch_btree_iter_set_pos(struct btree_iter *iter, struct bpos new_pos)
 {
 	EBUG_ON(bkey_cmp(new_pos, iter->pos) < 0); /* XXX handle this */
+
 	iter->pos = new_pos;
 }
 
@@ -1003,8 +1041,18 @@ void bch_btree_iter_advance_pos(struct btree_iter *iter)
 	 * equal to the start of the extent we returned, but we need to advance
 	 * to the end of the extent we returned.
 	 */
-	bch_btree_iter_set_pos(iter,
-		btree_type_successor(iter->btree_id, iter->k.p));
+	struct bpos new_pos = btree_type_successor(iter->btree_id, iter->k.p);
+
+	/*
+	 * Advancing past the end of the leaf we have locked - we're scanning
+	 * (inserts move with bch_btree_iter_set_pos(), and don't get here):
+	 */
+	if (btree_node_locked(iter, 0) &&
+	    !btree_iter_pos_cmp(new_pos, &iter->nodes[0]->key.k,
+				iter->is_extents))
+		iter->readahead = true;
+
+	bch_btree_iter_set_pos(iter, new_pos);
 }
 
 /* XXX: expensive */
@@ -1050,6 +1098,7 @@ struct bkey_s_c bch_btree_iter_peek(struct btree_iter *iter)
 		}
 
 		iter->pos = btree_type_successor(iter->btree_id, iter->pos);
+		iter->readahead = true;
 	}
 }
 
@@ -1115,6 +1164,7 @@ void __bch_btree_iter_init(struct btree_iter *iter, struct bch_fs *c,
 	iter->locks_want		= min(locks_want, BTREE_MAX_DEPTH);
 	iter->btree_id			= btree_id;
 	iter->at_end_of_leaf		= 0;
+	iter->readahead			= 0;
 	iter->error			= 0;
 	iter->c				= c;
 	iter->pos			= pos;
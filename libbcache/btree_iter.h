@@ -28,6 +28,12 @@ struct btree_iter {
 	 */
 	u8			at_end_of_leaf;
 
+	/*
+	 * Set once the iterator has walked off the end of a node - it's doing
+	 * a sequential scan, so btree_iter_down() reads ahead:
+	 */
+	u8			readahead;
+
 	s8			error;
 
 	struct bch_fs	*c;
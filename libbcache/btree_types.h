@@ -52,6 +52,20 @@ struct bset_tree {
 	struct bpos		max_key;
 };
 
+/* Btree node cache lru lists, see btree_cache.c: */
+enum btree_lru {
+	BTREE_LRU_RECENT,
+	BTREE_LRU_FREQUENT,
+	BTREE_LRU_NR,
+	BTREE_LRU_NONE	= BTREE_LRU_NR,
+};
+
+/* A node that was recently evicted from the btree node cache: */
+struct btree_cache_ghost {
+	u64			ptr;
+	u8			lru;
+};
+
 struct btree_write {
 	struct journal_entry_pin	journal;
 	struct closure_waitlist		wait;
@@ -93,6 +107,7 @@ struct btree {
 	u16			uncompacted_whiteout_u64s;
 	u8			page_order;
 	u8			unpack_fn_len;
+	u8			lru;
 
 	/*
 	 * XXX: add a delete sequence number, so when btree_node_relock() fails
@@ -143,6 +158,7 @@ enum btree_flags {
 	BTREE_NODE_accessed,
 	BTREE_NODE_write_in_flight,
 	BTREE_NODE_just_written,
+	BTREE_NODE_readahead,
 };
 
 BTREE_FLAG(read_error);
@@ -153,6 +169,7 @@ BTREE_FLAG(write_idx);
 BTREE_FLAG(accessed);
 BTREE_FLAG(write_in_flight);
 BTREE_FLAG(just_written);
+BTREE_FLAG(readahead);
 
 static inline struct btree_write *btree_current_write(struct btree *b)
 {
@@ -174,7 +174,8 @@ static void __btree_node_free(struct bch_fs *c, struct btree *b,
 	mca_hash_remove(c, b);
 
 	mutex_lock(&c->btree_cache_lock);
-	list_move(&b->list, &c->btree_cache_freeable);
+	mca_lru_del(c, b);
+	list_add(&b->list, &c->btree_cache_freeable);
 	mutex_unlock(&c->btree_cache_lock);
 
 	/*
@@ -361,7 +362,7 @@ static void bch_btree_set_root_inmem(struct bch_fs *c, struct btree *b,
 
 	/* Root nodes cannot be reaped */
 	mutex_lock(&c->btree_cache_lock);
-	list_del_init(&b->list);
+	mca_lru_del(c, b);
 	mutex_unlock(&c->btree_cache_lock);
 
 	mutex_lock(&c->btree_root_lock);
@@ -1421,6 +1422,7 @@ static void btree_split(struct btree *b, struct btree_iter *iter,
 	struct bch_fs *c = iter->c;
 	struct btree *parent = iter->nodes[b->level + 1];
 	struct btree *n1, *n2 = NULL, *n3 = NULL;
+	struct blk_plug plug;
 	u64 start_time = local_clock();
 
 	BUG_ON(!parent && (b != btree_node_root(c, b)));
@@ -1428,6 +1430,9 @@ static void btree_split(struct btree *b, struct btree_iter *iter,
 
 	bch_btree_interior_update_will_free_node(c, as, b);
 
+	/* new nodes come out of the same open buckets, let their writes merge: */
+	blk_start_plug(&plug);
+
 	n1 = btree_node_alloc_replacement(c, b, reserve);
 	if (b->level)
 		btree_split_insert_keys(iter, n1, insert_keys, reserve);
@@ -1475,6 +1480,8 @@ static void btree_split(struct btree *b, struct btree_iter *iter,
 
 	bch_btree_node_write(c, n1, &as->cl, SIX_LOCK_intent, -1);
 
+	blk_finish_plug(&plug);
+
 	/* New nodes all written, now make them visible: */
 
 	if (parent) {
@@ -2084,32 +2091,180 @@ err:
 	goto out;
 }
 
+static bool insert_list_key_in_leaf(struct btree *b, struct bkey_i *k)
+{
+	int cmp = bkey_cmp(bkey_start_pos(&k->k), b->key.k.p);
+
+	return btree_node_is_extents(b) ? cmp < 0 : cmp <= 0;
+}
+
+/*
+ * Inserts as many keys from the front of @keys as will go in the leaf @iter
+ * points to, under a single write lock and journal reservation: returns the
+ * next key to insert, setting @ret or @split if we stopped because of an error
+ * or because the leaf is full:
+ */
+static struct bkey_i *btree_insert_list_leaf(struct btree_insert *trans,
+					     struct btree_iter *iter,
+					     struct keylist *keys,
+					     struct bkey_i *k,
+					     bool *split, int *ret)
+{
+	struct bch_fs *c = trans->c;
+	struct btree *b = iter->nodes[0];
+	struct btree_insert_entry entry;
+	struct bkey_i *i;
+	unsigned u64s = 0, remaining = bch_btree_keys_u64s_remaining(c, b);
+	bool cycle_gc_lock = false;
+
+	for (i = k;
+	     i != keys->top &&
+	     insert_list_key_in_leaf(b, i) &&
+	     u64s + jset_u64s(i->k.u64s) <= remaining;
+	     i = bkey_next(i))
+		u64s += jset_u64s(i->k.u64s);
+
+	memset(&trans->journal_res, 0, sizeof(trans->journal_res));
+
+	*ret = !(trans->flags & BTREE_INSERT_JOURNAL_REPLAY)
+		? bch_journal_res_get(&c->journal, &trans->journal_res,
+				      jset_u64s(k->k.u64s),
+				      max(u64s, jset_u64s(k->k.u64s)))
+		: 0;
+	if (*ret)
+		return k;
+
+	btree_node_lock_for_insert(b, iter);
+
+	trans->entries	= &entry;
+	trans->did_work	= false;
+
+	while (k != keys->top && insert_list_key_in_leaf(b, k)) {
+		entry = BTREE_INSERT_ENTRY(iter, k);
+
+		if (!journal_res_insert_fits(trans, &entry))
+			break;
+
+		if (!bch_btree_node_insert_fits(c, b, k->k.u64s)) {
+			*split = !trans->did_work;
+			break;
+		}
+
+		bch_btree_iter_set_pos_same_leaf(iter, bkey_start_pos(&k->k));
+
+		switch (btree_insert_key(trans, &entry)) {
+		case BTREE_INSERT_OK:
+			k = bkey_next(k);
+			continue;
+		case BTREE_INSERT_JOURNAL_RES_FULL:
+		case BTREE_INSERT_NEED_TRAVERSE:
+			break;
+		case BTREE_INSERT_NEED_RESCHED:
+			*ret = -EAGAIN;
+			break;
+		case BTREE_INSERT_BTREE_NODE_FULL:
+			*split = !trans->did_work;
+			break;
+		case BTREE_INSERT_ENOSPC:
+			*ret = -ENOSPC;
+			break;
+		case BTREE_INSERT_NEED_GC_LOCK:
+			cycle_gc_lock = true;
+			break;
+		default:
+			BUG();
+		}
+		break;
+	}
+
+	btree_node_unlock_write(b, iter);
+	bch_journal_res_put(&c->journal, &trans->journal_res);
+
+	if (cycle_gc_lock) {
+		down_read(&c->gc_lock);
+		up_read(&c->gc_lock);
+	}
+
+	return k;
+}
+
+/**
+ * bch_btree_insert_list_at - insert a sorted list of keys
+ *
+ * Keys must be sorted and, for extents, not overlap. Keys that land in the
+ * same leaf are inserted together, under one write lock and one journal
+ * reservation; inserted keys are removed from @keys.
+ */
 int bch_btree_insert_list_at(struct btree_iter *iter,
 			     struct keylist *keys,
 			     struct disk_reservation *disk_res,
 			     struct extent_insert_hook *hook,
 			     u64 *journal_seq, unsigned flags)
 {
+	struct bch_fs *c = iter->c;
+	struct btree_insert trans = {
+		.c		= c,
+		.disk_res	= disk_res,
+		.journal_seq	= journal_seq,
+		.hook		= hook,
+		.flags		= flags,
+		.nr		= 1,
+	};
+	struct bkey_i *k = keys->keys;
+	int ret = 0;
+
 	BUG_ON(flags & BTREE_INSERT_ATOMIC);
 	BUG_ON(bch_keylist_empty(keys));
 	verify_keys_sorted(keys);
 
-	while (!bch_keylist_empty(keys)) {
-		/* need to traverse between each insert */
-		int ret = bch_btree_iter_traverse(iter);
+	if (unlikely(!percpu_ref_tryget(&c->writes)))
+		return -EROFS;
+
+	/*
+	 * traverse() takes the intent locks if we had to upgrade - and if a
+	 * split returns -EINTR, it leaves locks_want raised for the retry:
+	 */
+	bch_btree_iter_set_locks_want(iter, 1);
+
+	while (k != keys->top) {
+		bool split = false;
+
+		if (bkey_cmp(iter->pos, bkey_start_pos(&k->k)))
+			bch_btree_iter_set_pos(iter, bkey_start_pos(&k->k));
+
+		ret = bch_btree_iter_traverse(iter);
+		if (ret == -EINTR)
+			continue;
 		if (ret)
-			return ret;
+			break;
 
-		ret = bch_btree_insert_at(iter->c, disk_res, hook,
-				journal_seq, flags,
-				BTREE_INSERT_ENTRY(iter, bch_keylist_front(keys)));
+		k = btree_insert_list_leaf(&trans, iter, keys, k, &split, &ret);
 		if (ret)
-			return ret;
+			break;
 
-		bch_keylist_pop_front(keys);
+		if (split) {
+			/*
+			 * have to drop journal res before splitting, because
+			 * splitting means allocating new btree nodes, and
+			 * holding a journal reservation potentially blocks the
+			 * allocator:
+			 */
+			ret = bch_btree_split_leaf(iter, flags);
+			if (ret && ret != -EINTR)
+				break;
+			ret = 0;
+		} else if (!iter->at_end_of_leaf) {
+			foreground_maybe_merge(iter, btree_prev_sib);
+			foreground_maybe_merge(iter, btree_next_sib);
+		}
 	}
 
-	return 0;
+	/* drop the keys we inserted: */
+	memmove_u64s_down(keys->keys, k, keys->top_p - (u64 *) k);
+	keys->top_p -= (u64 *) k - keys->keys_p;
+
+	percpu_ref_put(&c->writes);
+	return ret;
 }
 
 /**
@@ -2343,3 +2498,432 @@ int bch_btree_node_rewrite(struct btree_iter *iter, struct btree *b,
 	bch_btree_reserve_put(c, reserve);
 	return 0;
 }
+
+/* Bulk loading: */
+
+/*
+ * Called with gc_lock held for read - as in btree_split(), drop it while we
+ * wait on the allocator, since the allocator may be waiting on gc:
+ */
+static struct btree_reserve *bulk_load_reserve_get(struct bch_fs *c)
+{
+	struct btree_reserve *reserve;
+	struct closure cl;
+
+	closure_init_stack(&cl);
+
+	while (1) {
+		reserve = __bch_btree_reserve_get(c, 1, BTREE_INSERT_NOFAIL, &cl);
+		if (!IS_ERR(reserve) || PTR_ERR(reserve) != -EAGAIN)
+			return reserve;
+
+		up_read(&c->gc_lock);
+		closure_sync(&cl);
+		down_read(&c->gc_lock);
+	}
+}
+
+static void bulk_load_level_reset(struct btree_bulk_load_level *lv,
+				  struct bpos min_key)
+{
+	lv->keys.top_p	= lv->keys.keys_p;
+	lv->nr_keys	= 0;
+	lv->val_u64s	= 0;
+	lv->min_key	= min_key;
+
+	bch_bkey_format_init(&lv->format);
+	bch_bkey_format_add_pos(&lv->format, min_key);
+}
+
+/*
+ * Packs the keys buffered at @level into a new node and starts the write;
+ * returns the new node with an intent lock held, along with the reserve it was
+ * allocated from (the reserve's disk reservation pays for the pointer to it):
+ */
+static struct btree *bulk_load_write_node(struct btree_bulk_load *l,
+					  unsigned level, bool last,
+					  struct btree_reserve **reserve)
+{
+	struct bch_fs *c = l->c;
+	struct btree_bulk_load_level *lv = &l->level[level];
+	struct bkey_i *k, *max = NULL;
+	struct bset *i;
+	struct btree *b;
+
+	*reserve = bulk_load_reserve_get(c);
+	if (IS_ERR(*reserve))
+		return ERR_CAST(*reserve);
+
+	/* Make room to record the node now, so linking it can't fail: */
+	if (bch_keylist_realloc(&lv->nodes, NULL, 0, BKEY_BTREE_PTR_U64s_MAX)) {
+		bch_btree_reserve_put(c, *reserve);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	if (!l->as)
+		l->as = bch_btree_interior_update_alloc(c);
+
+	b = bch_btree_node_alloc(c, level, l->btree_id, *reserve);
+
+	for_each_keylist_key(&lv->keys, k)
+		max = k;
+
+	b->data->min_key	= lv->min_key;
+	b->data->max_key	= last ? POS_MAX : max->k.p;
+	b->data->format		= bch_bkey_format_done(&lv->format);
+	b->key.k.p		= b->data->max_key;
+
+	btree_node_set_format(b, b->data->format);
+
+	i = btree_bset_first(b);
+
+	for_each_keylist_key(&lv->keys, k) {
+		struct bkey_packed *out = vstruct_last(i);
+
+		if (!bkey_pack(out, k, &b->format))
+			bkey_copy((struct bkey_i *) out, k);
+
+		le16_add_cpu(&i->u64s, out->u64s);
+		btree_keys_account_key_add(&b->nr, 0, out);
+	}
+
+	set_btree_bset_end(b, b->set);
+	BUG_ON(vstruct_blocks(b->data, c->block_bits) > btree_blocks(c));
+
+	btree_node_reset_sib_u64s(b);
+	bch_btree_build_aux_trees(b);
+	six_unlock_write(&b->lock);
+
+	bch_btree_node_write(c, b, &l->as->cl, SIX_LOCK_intent, -1);
+
+	lv->nr_nodes++;
+	bulk_load_level_reset(lv, btree_type_successor(l->btree_id,
+						       b->data->max_key));
+	return b;
+}
+
+static int bulk_load_level_add(struct btree_bulk_load *, unsigned,
+			       struct bkey_i *);
+
+/*
+ * Marks the pointer to @b, records it for gc (and for freeing @b if the load
+ * fails), and hands it to the next level up:
+ */
+static int bulk_load_link_node(struct btree_bulk_load *l, struct btree *b,
+			       struct btree_reserve *reserve)
+{
+	struct bch_fs *c = l->c;
+	struct bch_fs_usage stats = { 0 };
+	int ret;
+
+	bch_mark_key(c, bkey_i_to_s_c(&b->key),
+		     c->sb.btree_node_size, true,
+		     gc_pos_btree_root(l->btree_id), &stats, 0);
+	bch_fs_usage_apply(c, &stats, &reserve->disk_res,
+			   gc_pos_btree_root(l->btree_id));
+	bch_btree_reserve_put(c, reserve);
+
+	bch_keylist_add(&l->level[b->level].nodes, &b->key);
+
+	ret = bulk_load_level_add(l, b->level + 1, &b->key);
+
+	btree_open_bucket_put(c, b);
+	six_unlock_intent(&b->lock);
+	return ret;
+}
+
+static int bulk_load_level_add(struct btree_bulk_load *l, unsigned level,
+			       struct bkey_i *k)
+{
+	struct btree_bulk_load_level *lv = &l->level[level];
+	struct bkey_format_state s;
+	struct bkey_format f;
+	struct btree_reserve *reserve;
+	struct btree *b;
+	unsigned u64s;
+	int ret;
+
+	BUG_ON(level >= BTREE_MAX_DEPTH);
+
+	/* Would the node, repacked with this key, still fit? */
+	s = lv->format;
+	bch_bkey_format_add_key(&s, &k->k);
+	f = bch_bkey_format_done(&s);
+
+	u64s = (lv->nr_keys + 1) * f.key_u64s +
+		lv->val_u64s + bkey_val_u64s(&k->k);
+
+	if (lv->nr_keys &&
+	    __vstruct_blocks(struct btree_node, l->c->block_bits,
+			     u64s) > l->node_blocks) {
+		b = bulk_load_write_node(l, level, false, &reserve);
+		if (IS_ERR(b))
+			return PTR_ERR(b);
+
+		ret = bulk_load_link_node(l, b, reserve);
+		if (ret)
+			return ret;
+
+		s = lv->format;
+		bch_bkey_format_add_key(&s, &k->k);
+	}
+
+	if (bch_keylist_realloc(&lv->keys, NULL, 0, k->k.u64s))
+		return -ENOMEM;
+
+	bch_keylist_add(&lv->keys, k);
+	lv->format = s;
+	lv->nr_keys++;
+	lv->val_u64s += bkey_val_u64s(&k->k);
+	return 0;
+}
+
+/* If we can't read the leaf back, the marks stay until gc fixes them: */
+static void bulk_load_unmark_leaf(struct btree_bulk_load *l,
+				  const struct bkey_i *node,
+				  struct bch_fs_usage *stats)
+{
+	struct btree_node_iter iter;
+	struct bkey unpacked;
+	struct bkey_s_c k;
+	struct btree *b;
+
+	b = bch_btree_node_get_unlinked(l->c, node, 0, l->btree_id);
+	if (IS_ERR(b))
+		return;
+
+	for_each_btree_node_key_unpack(b, k, &iter, true, &unpacked)
+		bch_mark_key(l->c, k, -(s64) k.k->size, false,
+			     gc_pos_btree_root(l->btree_id), stats, 0);
+
+	six_unlock_read(&b->lock);
+}
+
+/*
+ * Tears down a bulk load that failed: frees the nodes it wrote, and drops the
+ * marks it added. Called with gc_lock held for read.
+ */
+static void bulk_load_abort(struct btree_bulk_load *l)
+{
+	struct bch_fs *c = l->c;
+	struct gc_pos pos = gc_pos_btree_root(l->btree_id);
+	struct bch_fs_usage stats = { 0 };
+	struct bkey_i *k;
+	unsigned level;
+
+	if (l->as) {
+		/* Nodes can't be evicted until their writes have completed: */
+		closure_sync(&l->as->cl);
+		continue_at_noreturn(&l->as->cl,
+				     btree_interior_update_nodes_reachable,
+				     system_wq);
+		l->as = NULL;
+	}
+
+	for (level = 0; level < BTREE_MAX_DEPTH; level++)
+		for_each_keylist_key(&l->level[level].nodes, k) {
+			if (!level && l->btree_id == BTREE_ID_EXTENTS)
+				bulk_load_unmark_leaf(l, k, &stats);
+
+			bch_mark_key(c, bkey_i_to_s_c(k),
+				     -c->sb.btree_node_size, true,
+				     pos, &stats, 0);
+			bch_btree_node_evict(c, k);
+		}
+
+	if (l->btree_id == BTREE_ID_EXTENTS)
+		for_each_keylist_key(&l->level[0].keys, k)
+			bch_mark_key(c, bkey_i_to_s_c(k), -(s64) k->k.size,
+				     false, pos, &stats, 0);
+
+	bch_fs_usage_apply(c, &stats, NULL, pos);
+}
+
+static void bulk_load_exit(struct btree_bulk_load *l)
+{
+	struct bch_fs *c = l->c;
+	unsigned level;
+
+	mutex_lock(&c->btree_interior_update_lock);
+	list_del(&l->list);
+	mutex_unlock(&c->btree_interior_update_lock);
+
+	for (level = 0; level < BTREE_MAX_DEPTH; level++) {
+		bch_keylist_free(&l->level[level].keys, NULL);
+		bch_keylist_free(&l->level[level].nodes, NULL);
+	}
+}
+
+/**
+ * bch_btree_bulk_load_init - start bulk loading btree @id
+ *
+ * @fill is the percentage of each node to fill before starting the next one;
+ * the btree must be empty.
+ */
+int bch_btree_bulk_load_init(struct btree_bulk_load *l, struct bch_fs *c,
+			     enum btree_id id, unsigned fill)
+{
+	struct btree_iter iter;
+	struct btree *b;
+	unsigned level;
+	int ret;
+
+	memset(l, 0, sizeof(*l));
+	l->c		= c;
+	l->btree_id	= id;
+	l->node_blocks	= max(1U, btree_blocks(c) * clamp_t(unsigned, fill, 1, 100) / 100);
+
+	bch_btree_iter_init(&iter, c, id, POS_MIN);
+	ret = bch_btree_iter_traverse(&iter);
+	b = iter.nodes[0];
+	if (!ret && (b != btree_node_root(c, b) || b->nr.live_u64s))
+		ret = -EEXIST;
+	bch_btree_iter_unlock(&iter);
+
+	if (ret)
+		return ret;
+
+	for (level = 0; level < BTREE_MAX_DEPTH; level++)
+		bulk_load_level_reset(&l->level[level], POS_MIN);
+
+	/* gc walks the list with gc_lock held for write: */
+	down_read(&c->gc_lock);
+	mutex_lock(&c->btree_interior_update_lock);
+	list_add(&l->list, &c->btree_bulk_loads);
+	mutex_unlock(&c->btree_interior_update_lock);
+	up_read(&c->gc_lock);
+
+	return 0;
+}
+
+static bool bulk_load_key_in_order(struct btree_bulk_load *l,
+				   struct bkey_i *k)
+{
+	if (!l->nr_keys)
+		return true;
+
+	return l->btree_id == BTREE_ID_EXTENTS
+		? bkey_cmp(bkey_start_pos(&k->k), l->last_pos) >= 0
+		: bkey_cmp(k->k.p, l->last_pos) > 0;
+}
+
+/**
+ * bch_btree_bulk_load_add - add a key to a bulk load
+ *
+ * @res pays for the space @k references, as with bch_btree_insert(). Returns
+ * -EINVAL if @k isn't after the previous key; on any error the load has been
+ * torn down, and bch_btree_bulk_load_finish() mustn't be called.
+ */
+int bch_btree_bulk_load_add(struct btree_bulk_load *l, struct bkey_i *k,
+			    struct disk_reservation *res)
+{
+	struct bch_fs *c = l->c;
+	struct bch_fs_usage stats = { 0 };
+	int ret;
+
+	down_read(&c->gc_lock);
+
+	ret = bulk_load_key_in_order(l, k)
+		? bulk_load_level_add(l, 0, k)
+		: -EINVAL;
+	if (ret) {
+		bulk_load_abort(l);
+		bulk_load_exit(l);
+		goto out;
+	}
+
+	if (l->btree_id == BTREE_ID_EXTENTS) {
+		bch_mark_key(c, bkey_i_to_s_c(k), k->k.size, false,
+			     gc_pos_btree_root(l->btree_id), &stats, 0);
+		bch_fs_usage_apply(c, &stats, res,
+				   gc_pos_btree_root(l->btree_id));
+	}
+
+	l->nr_keys++;
+	l->last_pos = k->k.p;
+out:
+	up_read(&c->gc_lock);
+	return ret;
+}
+
+static int bulk_load_set_root(struct btree_bulk_load *l, struct btree *b,
+			      struct btree_reserve *reserve)
+{
+	struct bch_fs *c = l->c;
+	struct btree_iter iter;
+	struct btree *old;
+	int ret;
+
+	bch_btree_iter_init_intent(&iter, c, l->btree_id, POS_MIN);
+
+	while ((ret = bch_btree_iter_traverse(&iter)) == -EINTR)
+		;
+	if (ret)
+		goto out;
+
+	/* Something else inserted into the btree while we were loading it: */
+	old = iter.nodes[0];
+	if (old != btree_node_root(c, old) || old->nr.live_u64s) {
+		ret = -EEXIST;
+		goto out;
+	}
+
+	bch_btree_interior_update_will_free_node(c, l->as, old);
+	bch_btree_set_root(&iter, b, l->as, reserve);
+	bch_btree_node_free_inmem(&iter, old);
+out:
+	bch_btree_iter_unlock(&iter);
+	return ret;
+}
+
+/**
+ * bch_btree_bulk_load_finish - write out the remaining partial nodes and
+ * install the new root
+ *
+ * On error, the load is torn down and the btree is left as it was - -EEXIST if
+ * something else was inserted into it during the load.
+ */
+int bch_btree_bulk_load_finish(struct btree_bulk_load *l)
+{
+	struct bch_fs *c = l->c;
+	struct btree_reserve *reserve;
+	struct btree *b;
+	unsigned level;
+	int ret = 0;
+
+	down_read(&c->gc_lock);
+
+	for (level = 0; l->nr_keys && level < BTREE_MAX_DEPTH; level++) {
+		b = bulk_load_write_node(l, level, true, &reserve);
+		if (IS_ERR(b)) {
+			ret = PTR_ERR(b);
+			goto err;
+		}
+
+		if (l->level[level].nr_nodes == 1) {
+			ret = bulk_load_set_root(l, b, reserve);
+			if (ret) {
+				/* waits for @b's write, too: */
+				bulk_load_abort(l);
+				bch_btree_node_free_never_inserted(c, b);
+			} else {
+				btree_open_bucket_put(c, b);
+			}
+
+			six_unlock_intent(&b->lock);
+			bch_btree_reserve_put(c, reserve);
+			break;
+		}
+
+		ret = bulk_load_link_node(l, b, reserve);
+		if (ret)
+			goto err;
+	}
+out:
+	bulk_load_exit(l);
+	up_read(&c->gc_lock);
+	return ret;
+err:
+	bulk_load_abort(l);
+	goto out;
+}
@@ -420,5 +420,47 @@ int bch_btree_delete_range(struct bch_fs *, enum btree_id,
 
 int bch_btree_node_rewrite(struct btree_iter *, struct btree *, struct closure *);
 
+/*
+ * Bulk loading: builds a btree bottom up from a stream of keys that arrive in
+ * sorted order, instead of inserting them one at a time. Leaf nodes are packed
+ * and written as they fill; interior nodes are built from their keys in turn,
+ * and the finished tree replaces the (empty) existing root with a single root
+ * update. Keys aren't journalled - they're persistent once the new root is.
+ *
+ * Keys must be added in sorted order; for extents, they mustn't overlap. Until
+ * the new root is installed, gc marks what the load has written and buffered.
+ * If adding a key or finishing fails, the load is torn down: the nodes it wrote
+ * are freed, and nothing it loaded is visible.
+ */
+struct btree_bulk_load_level {
+	struct keylist			keys;
+	/* nodes written at this level: */
+	struct keylist			nodes;
+	struct bkey_format_state	format;
+	unsigned			nr_keys;
+	unsigned			val_u64s;
+	unsigned			nr_nodes;
+	struct bpos			min_key;
+};
+
+struct btree_bulk_load {
+	struct bch_fs			*c;
+	enum btree_id			btree_id;
+	unsigned			node_blocks;
+
+	struct list_head		list;
+	struct btree_interior_update	*as;
+	u64				nr_keys;
+	struct bpos			last_pos;
+
+	struct btree_bulk_load_level	level[BTREE_MAX_DEPTH];
+};
+
+int bch_btree_bulk_load_init(struct btree_bulk_load *, struct bch_fs *,
+			     enum btree_id, unsigned);
+int bch_btree_bulk_load_add(struct btree_bulk_load *, struct bkey_i *,
+			    struct disk_reservation *);
+int bch_btree_bulk_load_finish(struct btree_bulk_load *);
+
 #endif /* _BCACHE_BTREE_INSERT_H */
 
@@ -6,8 +6,6 @@
 
 #include <crypto/chacha20.h>
 
-u64 bch_crc64_update(u64, const void *, size_t);
-
 #define BCH_NONCE_EXTENT	cpu_to_le32(1 << 28)
 #define BCH_NONCE_BTREE		cpu_to_le32(2 << 28)
 #define BCH_NONCE_JOURNAL	cpu_to_le32(3 << 28)
@@ -4,8 +4,10 @@
 #include "io.h"
 #include "super-io.h"
 
+#include <asm/unaligned.h>
 #include <linux/lz4.h>
 #include <linux/zlib.h>
+#include <linux/zstd.h>
 
 enum bounced {
 	BOUNCED_CONTIG,
@@ -20,16 +22,21 @@ static void *__bounce_alloc(struct bch_fs *c, unsigned size,
 {
 	void *data;
 
-	*bounced = BOUNCED_KMALLOCED;
-	data = kmalloc(size, GFP_NOIO|__GFP_NOWARN);
-	if (data)
-		return data;
-
+	/*
+	 * Try the mempool first: its elements are always big enough, and
+	 * they're pages, so they get recycled by the page allocator instead of
+	 * churning the heap:
+	 */
 	*bounced = BOUNCED_MEMPOOLED;
 	data = mempool_alloc(&c->compression_bounce[direction], GFP_NOWAIT);
 	if (data)
 		return page_address(data);
 
+	*bounced = BOUNCED_KMALLOCED;
+	data = kmalloc(size, GFP_NOIO|__GFP_NOWARN);
+	if (data)
+		return data;
+
 	*bounced = BOUNCED_VMALLOCED;
 	data = vmalloc(size);
 	if (data)
@@ -40,9 +47,9 @@ static void *__bounce_alloc(struct bch_fs *c, unsigned size,
 	return page_address(data);
 }
 
-static void *__bio_map_or_bounce(struct bch_fs *c,
-				 struct bio *bio, struct bvec_iter start,
-				 unsigned *bounced, int direction)
+/* Returns NULL if the bio's pages can't be mapped contiguously: */
+static void *__bio_map(struct bio *bio, struct bvec_iter start,
+		       unsigned *bounced)
 {
 	struct bio_vec bv;
 	struct bvec_iter iter;
@@ -68,8 +75,9 @@ static void *__bio_map_or_bounce(struct bch_fs *c,
 	__bio_for_each_segment(bv, bio, iter, start) {
 		if ((!first && bv.bv_offset) ||
 		    prev_end != PAGE_SIZE)
-			goto bounce;
+			return NULL;
 
+		first = false;
 		prev_end = bv.bv_offset + bv.bv_len;
 		nr_pages++;
 	}
@@ -80,7 +88,7 @@ static void *__bio_map_or_bounce(struct bch_fs *c,
 		? kmalloc_array(nr_pages, sizeof(struct page *), GFP_NOIO)
 		: stack_pages;
 	if (!pages)
-		goto bounce;
+		return NULL;
 
 	nr_pages = 0;
 	__bio_for_each_segment(bv, bio, iter, start)
@@ -90,8 +98,18 @@ static void *__bio_map_or_bounce(struct bch_fs *c,
 	if (pages != stack_pages)
 		kfree(pages);
 
-	return data + bio_iter_offset(bio, start);
-bounce:
+	return data ? data + bio_iter_offset(bio, start) : NULL;
+}
+
+static void *__bio_map_or_bounce(struct bch_fs *c,
+				 struct bio *bio, struct bvec_iter start,
+				 unsigned *bounced, int direction)
+{
+	void *data = __bio_map(bio, start, bounced);
+
+	if (data)
+		return data;
+
 	data = __bounce_alloc(c, start.bi_size, bounced, direction);
 
 	if (direction == READ)
@@ -128,10 +146,20 @@ static void bio_unmap_or_unbounce(struct bch_fs *c, void *data,
 	}
 }
 
+static ZSTD_parameters bch_zstd_params(struct bch_fs *c)
+{
+	return ZSTD_getParams(c->opts.zstd_level,
+			      BCH_ENCODED_EXTENT_MAX << 9, 0);
+}
+
 static inline void zlib_set_workspace(z_stream *strm, void *workspace)
 {
 #ifdef __KERNEL__
 	strm->workspace = workspace;
+#else
+	strm->zalloc	= Z_NULL;
+	strm->zfree	= Z_NULL;
+	strm->opaque	= Z_NULL;
 #endif
 }
 
@@ -174,6 +202,7 @@ static int __bio_uncompress(struct bch_fs *c, struct bio *src,
 		zlib_inflateInit2(&strm, -MAX_WBITS);
 
 		ret = zlib_inflate(&strm, Z_FINISH);
+		zlib_inflateEnd(&strm);
 
 		if (workspace == c->zlib_workspace)
 			mutex_unlock(&c->zlib_workspace_lock);
@@ -186,6 +215,32 @@ static int __bio_uncompress(struct bch_fs *c, struct bio *src,
 		}
 		break;
 	}
+	case BCH_COMPRESSION_ZSTD: {
+		void *workspace;
+		ZSTD_DCtx *ctx;
+		size_t len;
+
+		/* compressed extents are padded to a block boundary: */
+		src_len = ZSTD_findFrameCompressedSize(src_data, src_len);
+		if (ZSTD_isError(src_len)) {
+			ret = -EIO;
+			goto err;
+		}
+
+		workspace = mempool_alloc(&c->zstd_workspace_pool, GFP_NOIO);
+		ctx = ZSTD_initDCtx(workspace, ZSTD_DCtxWorkspaceBound());
+
+		len = ZSTD_decompressDCtx(ctx, dst_data, dst_len,
+					  src_data, src_len);
+
+		mempool_free(workspace, &c->zstd_workspace_pool);
+
+		if (len != dst_len) {
+			ret = -EIO;
+			goto err;
+		}
+		break;
+	}
 	default:
 		BUG();
 	}
@@ -195,6 +250,278 @@ err:
 	return ret;
 }
 
+/*
+ * Decompressing straight into the destination bio's pages, when they can't be
+ * mapped contiguously - instead of decompressing into a bounce buffer and then
+ * copying:
+ *
+ * lz4 matches refer back to earlier output, so the lz4 decoder here works on a
+ * list of the destination segments and copies matches across them; this only
+ * works when the destination is the whole extent.
+ *
+ * zlib is a streaming decompressor that keeps its own window, so we just hand
+ * it one segment at a time - and since it doesn't need the skipped data, this
+ * also works when we're only reading part of an extent.
+ *
+ * zstd isn't done here: its streaming decompressor copies output through its
+ * own buffer when the output isn't contiguous, which saves nothing.
+ */
+
+#define SG_OUT_SEGS		32
+
+struct sg_out {
+	struct sg_seg {
+		u8		*p;
+		unsigned	start;
+		unsigned	len;
+	}		segs[SG_OUT_SEGS];
+	unsigned	nr;
+	unsigned	idx;
+	unsigned	done;	/* within segs[idx] */
+	unsigned	pos;
+	unsigned	size;
+};
+
+static int sg_out_init(struct sg_out *o, struct bio *bio,
+		       struct bvec_iter start)
+{
+#ifndef CONFIG_HIGHMEM
+	struct bio_vec bv;
+	struct bvec_iter iter;
+
+	o->nr = o->idx = o->done = o->pos = o->size = 0;
+
+	__bio_for_each_contig_segment(bv, bio, iter, start) {
+		if (o->nr == SG_OUT_SEGS)
+			return -EAGAIN;
+
+		o->segs[o->nr++] = (struct sg_seg) {
+			.p	= page_address(bv.bv_page) + bv.bv_offset,
+			.start	= o->size,
+			.len	= bv.bv_len,
+		};
+		o->size += bv.bv_len;
+	}
+
+	return 0;
+#else
+	return -EAGAIN;
+#endif
+}
+
+static inline void sg_out_advance(struct sg_out *o, unsigned n)
+{
+	o->pos	+= n;
+	o->done	+= n;
+
+	if (o->done == o->segs[o->idx].len) {
+		o->idx++;
+		o->done = 0;
+	}
+}
+
+static int sg_out_copy(struct sg_out *o, const u8 *src, unsigned len)
+{
+	if (len > o->size - o->pos)
+		return -1;
+
+	while (len) {
+		struct sg_seg *d = &o->segs[o->idx];
+		unsigned n = min(len, d->len - o->done);
+
+		memcpy(d->p + o->done, src, n);
+		src += n;
+		len -= n;
+		sg_out_advance(o, n);
+	}
+
+	return 0;
+}
+
+/* Copy @len bytes from @offset bytes back in the output: */
+static int sg_out_match(struct sg_out *o, unsigned offset, unsigned len)
+{
+	unsigned from, i, j;
+
+	if (!offset || offset > o->pos || len > o->size - o->pos)
+		return -1;
+
+	from = o->pos - offset;
+
+	for (j = o->idx; o->segs[j].start > from; --j)
+		;
+
+	while (len) {
+		struct sg_seg *d = &o->segs[o->idx], *s = &o->segs[j];
+		unsigned n = min3(len, d->len - o->done,
+				  s->len - (from - s->start));
+		u8 *dp = d->p + o->done;
+		const u8 *sp = s->p + (from - s->start);
+
+		/* overlapping matches repeat the last @offset bytes: */
+		if (n > offset)
+			for (i = 0; i < n; i++)
+				dp[i] = sp[i];
+		else
+			memcpy(dp, sp, n);
+
+		from += n;
+		len -= n;
+		sg_out_advance(o, n);
+
+		if (from == s->start + s->len)
+			j++;
+	}
+
+	return 0;
+}
+
+static int lz4_get_length(const u8 **ip, const u8 *iend, size_t *len)
+{
+	u8 b;
+
+	if (*len == 15)
+		do {
+			if (*ip == iend)
+				return -1;
+			*len += b = *(*ip)++;
+		} while (b == 255);
+
+	return 0;
+}
+
+static int lz4_decompress_sg(const u8 *src, size_t src_len, struct sg_out *o)
+{
+	const u8 *ip = src, *iend = src + src_len;
+	unsigned token, offset;
+	size_t len;
+
+	while (1) {
+		if (ip == iend)
+			return -1;
+
+		token = *ip++;
+
+		len = token >> 4;
+		if (lz4_get_length(&ip, iend, &len) ||
+		    len > iend - ip ||
+		    sg_out_copy(o, ip, len))
+			return -1;
+		ip += len;
+
+		/* the last sequence is just literals: */
+		if (o->pos == o->size)
+			return 0;
+
+		if (iend - ip < 2)
+			return -1;
+
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+
+		len = token & 15;
+		if (lz4_get_length(&ip, iend, &len) ||
+		    sg_out_match(o, offset, len + 4))
+			return -1;
+	}
+}
+
+static int zlib_inflate_sg(struct bch_fs *c, void *src_data, size_t src_len,
+			   struct sg_out *o, unsigned skip)
+{
+	void *workspace;
+	z_stream strm;
+	unsigned i;
+	int ret;
+
+	workspace = kmalloc(zlib_inflate_workspacesize(),
+			    GFP_NOIO|__GFP_NOWARN);
+	if (!workspace) {
+		mutex_lock(&c->zlib_workspace_lock);
+		workspace = c->zlib_workspace;
+	}
+
+	strm.next_in	= src_data;
+	strm.avail_in	= src_len;
+	zlib_set_workspace(&strm, workspace);
+	zlib_inflateInit2(&strm, -MAX_WBITS);
+
+	/*
+	 * Data before the part we're reading gets decompressed into the first
+	 * segment and then overwritten:
+	 */
+	while (skip) {
+		strm.next_out	= o->segs[0].p;
+		strm.avail_out	= min(skip, o->segs[0].len);
+		skip		-= strm.avail_out;
+
+		ret = zlib_inflate(&strm, Z_SYNC_FLUSH);
+		if (ret != Z_OK || strm.avail_out)
+			goto err;
+	}
+
+	for (i = 0; i < o->nr; i++) {
+		strm.next_out	= o->segs[i].p;
+		strm.avail_out	= o->segs[i].len;
+
+		ret = zlib_inflate(&strm, Z_SYNC_FLUSH);
+		if ((ret != Z_OK && ret != Z_STREAM_END) || strm.avail_out)
+			goto err;
+	}
+
+	ret = 0;
+out:
+	zlib_inflateEnd(&strm);
+
+	if (workspace == c->zlib_workspace)
+		mutex_unlock(&c->zlib_workspace_lock);
+	else
+		kfree(workspace);
+
+	return ret;
+err:
+	ret = -EIO;
+	goto out;
+}
+
+/* Returns -EAGAIN if we have to bounce: */
+static int bio_uncompress_sg(struct bch_fs *c, struct bio *src,
+			     struct bio *dst, struct bvec_iter dst_iter,
+			     struct bch_extent_crc128 crc)
+{
+	size_t dst_len = crc_uncompressed_size(NULL, &crc) << 9;
+	struct sg_out o;
+	void *src_data;
+	unsigned src_bounced;
+	int ret;
+
+	switch (crc.compression_type) {
+	case BCH_COMPRESSION_LZ4:
+		if (dst_len != dst_iter.bi_size)
+			return -EAGAIN;
+		break;
+	case BCH_COMPRESSION_GZIP:
+		break;
+	default:
+		return -EAGAIN;
+	}
+
+	ret = sg_out_init(&o, dst, dst_iter);
+	if (ret)
+		return ret;
+
+	src_data = bio_map_or_bounce(c, src, &src_bounced, READ);
+
+	ret = crc.compression_type == BCH_COMPRESSION_LZ4
+		? lz4_decompress_sg(src_data, src->bi_iter.bi_size, &o)
+		: zlib_inflate_sg(c, src_data, src->bi_iter.bi_size, &o,
+				  crc.offset << 9);
+
+	bio_unmap_or_unbounce(c, src_data, src_bounced, READ);
+
+	return ret ? -EIO : 0;
+}
+
 int bch_bio_uncompress_inplace(struct bch_fs *c, struct bio *bio,
 			       unsigned live_data_sectors,
 			       struct bch_extent_crc128 crc)
@@ -256,16 +583,31 @@ int bch_bio_uncompress(struct bch_fs *c, struct bio *src,
 	size_t dst_len = crc_uncompressed_size(NULL, &crc) << 9;
 	int ret = -ENOMEM;
 
-	dst_data = dst_len == dst_iter.bi_size
-		? __bio_map_or_bounce(c, dst, dst_iter, &dst_bounced, WRITE)
-		: __bounce_alloc(c, dst_len, &dst_bounced, WRITE);
+	if (dst_len == dst_iter.bi_size)
+		dst_data = __bio_map(dst, dst_iter, &dst_bounced);
+
+	if (!dst_data) {
+		ret = bio_uncompress_sg(c, src, dst, dst_iter, crc);
+		if (ret != -EAGAIN) {
+			if (!ret)
+				atomic64_inc(&c->decompress_direct);
+			return ret;
+		}
+
+		dst_data = __bounce_alloc(c, dst_len, &dst_bounced, WRITE);
+	}
 
 	ret = __bio_uncompress(c, src, dst_data, crc);
 	if (ret)
 		goto err;
 
-	if (dst_bounced)
+	if (dst_bounced != BOUNCED_CONTIG &&
+	    dst_bounced != BOUNCED_MAPPED) {
 		memcpy_to_bio(dst, dst_iter, dst_data + (crc.offset << 9));
+		atomic64_inc(&c->decompress_bounced);
+	} else {
+		atomic64_inc(&c->decompress_direct);
+	}
 err:
 	bio_unmap_or_unbounce(c, dst_data, dst_bounced, WRITE);
 	return ret;
@@ -362,6 +704,36 @@ zlib_err:
 		*src_len = strm.total_in;
 		break;
 	}
+	case BCH_COMPRESSION_ZSTD: {
+		ZSTD_parameters params = bch_zstd_params(c);
+		void *workspace;
+		ZSTD_CCtx *ctx;
+		size_t len;
+
+		workspace = mempool_alloc(&c->zstd_workspace_pool, GFP_NOIO);
+		ctx = ZSTD_initCCtx(workspace,
+				    ZSTD_CCtxWorkspaceBound(params.cParams));
+
+		/*
+		 * Unlike lz4, zstd can't tell us how much input fit if the
+		 * output didn't - so if it doesn't fit, it's not getting
+		 * compressed:
+		 */
+		*src_len = src->bi_iter.bi_size;
+		len = ZSTD_compressCCtx(ctx,
+					dst_data, dst->bi_iter.bi_size,
+					src_data, *src_len,
+					params);
+
+		mempool_free(workspace, &c->zstd_workspace_pool);
+
+		if (ZSTD_isError(len))
+			goto err;
+
+		*dst_len = len;
+		ret = 0;
+		break;
+	}
 	default:
 		BUG();
 	}
@@ -391,7 +763,115 @@ err:
 	return ret;
 }
 
-void bch_bio_compress(struct bch_fs *c,
+/*
+ * Compression heuristics:
+ *
+ * Data that's already compressed or encrypted looks like random bytes, so
+ * before running the compressor we sample a bit of the input and estimate its
+ * byte entropy - if it's close to 8 bits per byte, we don't bother. This won't
+ * catch data that only compresses because of long repeats (e.g. the same random
+ * block written over and over), but that's rare and we only lose some space.
+ *
+ * Also, each write point remembers how compression has been going for writes
+ * through it: after a few failures in a row we stop trying entirely for a
+ * while, backing off exponentially, since whatever's writing through it is
+ * probably going to keep writing the same kind of data.
+ */
+
+#define COMPRESS_SAMPLES		16
+#define COMPRESS_SAMPLE_BYTES		64
+
+/* bits per byte, with 4 fractional bits: */
+#define COMPRESS_ENTROPY_MAX		(15 << 3)
+
+#define COMPRESS_FAIL_THRESHOLD		4
+#define COMPRESS_BACKOFF_MAX		64
+
+/* log2(x), with 4 fractional bits: */
+static unsigned log2_q4(unsigned x)
+{
+	unsigned i, ret = ilog2(x) << 4;
+	u64 m = ((u64) x << 16) >> ilog2(x);
+
+	for (i = 0; i < 4; i++) {
+		m = (m * m) >> 16;
+		if (m >= 2 << 16) {
+			ret |= 8 >> i;
+			m >>= 1;
+		}
+	}
+
+	return ret;
+}
+
+static bool bio_looks_incompressible(struct bio *bio)
+{
+	struct bvec_iter sample, pos = bio->bi_iter;
+	struct bio_vec bv;
+	u16 counts[256] = { 0 };
+	unsigned nr = min_t(unsigned, COMPRESS_SAMPLES,
+			    pos.bi_size / COMPRESS_SAMPLE_BYTES);
+	unsigned i, j, n = 0;
+	u64 sum = 0;
+
+	if (!nr)
+		return false;
+
+	for (i = 0; i < nr; i++) {
+		struct bvec_iter start = pos;
+
+		start.bi_size = COMPRESS_SAMPLE_BYTES;
+
+		__bio_for_each_segment(bv, bio, sample, start) {
+			u8 *p = kmap_atomic(bv.bv_page) + bv.bv_offset;
+
+			for (j = 0; j < bv.bv_len; j++)
+				counts[p[j]]++;
+			kunmap_atomic(p);
+		}
+
+		n += COMPRESS_SAMPLE_BYTES;
+
+		if (i + 1 < nr)
+			bio_advance_iter(bio, &pos,
+					 bio->bi_iter.bi_size / nr);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(counts); i++)
+		if (counts[i])
+			sum += counts[i] * log2_q4(counts[i]);
+
+	/* entropy = log2(n) - sum(count * log2(count)) / n: */
+	return (u64) log2_q4(n) * n - sum > (u64) COMPRESS_ENTROPY_MAX * n;
+}
+
+static bool compress_backing_off(struct write_point *wp)
+{
+	if (!wp->compress_skip)
+		return false;
+
+	wp->compress_skip--;
+	return true;
+}
+
+static void compress_result(struct write_point *wp, bool success)
+{
+	if (success) {
+		wp->compress_fail = 0;
+		return;
+	}
+
+	if (wp->compress_fail < U8_MAX)
+		wp->compress_fail++;
+
+	if (wp->compress_fail >= COMPRESS_FAIL_THRESHOLD)
+		wp->compress_skip =
+			1U << min_t(unsigned, wp->compress_fail -
+				    COMPRESS_FAIL_THRESHOLD,
+				    ilog2(COMPRESS_BACKOFF_MAX));
+}
+
+void bch_bio_compress(struct bch_fs *c, struct write_point *wp,
 		      struct bio *dst, size_t *dst_len,
 		      struct bio *src, size_t *src_len,
 		      unsigned *compression_type)
@@ -408,12 +888,32 @@ void bch_bio_compress(struct bch_fs *c,
 		min(dst->bi_iter.bi_size, src->bi_iter.bi_size);
 
 	/* If it's only one block, don't bother trying to compress: */
-	if (*compression_type != BCH_COMPRESSION_NONE &&
-	    bio_sectors(src) > c->sb.block_size &&
-	    !__bio_compress(c, dst, dst_len, src, src_len, *compression_type))
+	if (*compression_type == BCH_COMPRESSION_NONE ||
+	    bio_sectors(src) <= c->sb.block_size)
+		goto nocompress;
+
+	if (compress_backing_off(wp)) {
+		atomic64_inc(&c->compress_skipped_backoff);
+		goto nocompress;
+	}
+
+	if (bio_looks_incompressible(src)) {
+		atomic64_inc(&c->compress_skipped_entropy);
+		compress_result(wp, false);
+		goto nocompress;
+	}
+
+	atomic64_inc(&c->compress_attempted);
+
+	if (!__bio_compress(c, dst, dst_len, src, src_len, *compression_type)) {
+		compress_result(wp, true);
 		goto out;
+	}
 
-	/* If compressing failed (didn't get smaller), just copy: */
+	atomic64_inc(&c->compress_wasted);
+	compress_result(wp, false);
+nocompress:
+	/* If compressing failed (didn't get smaller) or was skipped, just copy: */
 	*compression_type = BCH_COMPRESSION_NONE;
 	*dst_len = *src_len = min(dst->bi_iter.bi_size, src->bi_iter.bi_size);
 	bio_copy_data(dst, src);
@@ -441,6 +941,12 @@ int bch_check_set_has_compressed_data(struct bch_fs *c,
 
 		bch_sb_set_feature(c->disk_sb, BCH_FEATURE_GZIP);
 		break;
+	case BCH_COMPRESSION_ZSTD:
+		if (bch_sb_test_feature(c->disk_sb, BCH_FEATURE_ZSTD))
+			return 0;
+
+		bch_sb_set_feature(c->disk_sb, BCH_FEATURE_ZSTD);
+		break;
 	}
 
 	return bch_fs_compress_init(c);
@@ -449,6 +955,7 @@ int bch_check_set_has_compressed_data(struct bch_fs *c,
 void bch_fs_compress_exit(struct bch_fs *c)
 {
 	vfree(c->zlib_workspace);
+	mempool_exit(&c->zstd_workspace_pool);
 	mempool_exit(&c->lz4_workspace_pool);
 	mempool_exit(&c->compression_bounce[WRITE]);
 	mempool_exit(&c->compression_bounce[READ]);
@@ -458,13 +965,18 @@ void bch_fs_compress_exit(struct bch_fs *c)
 	max_t(size_t, zlib_inflate_workspacesize(),			\
 	      zlib_deflate_workspacesize(MAX_WBITS, DEF_MEM_LEVEL))
 
+#define ZSTD_WORKSPACE_SIZE(c)						\
+	max_t(size_t, ZSTD_CCtxWorkspaceBound(bch_zstd_params(c).cParams),\
+	      ZSTD_DCtxWorkspaceBound())
+
 int bch_fs_compress_init(struct bch_fs *c)
 {
 	unsigned order = get_order(BCH_ENCODED_EXTENT_MAX << 9);
 	int ret;
 
 	if (!bch_sb_test_feature(c->disk_sb, BCH_FEATURE_LZ4) &&
-	    !bch_sb_test_feature(c->disk_sb, BCH_FEATURE_GZIP))
+	    !bch_sb_test_feature(c->disk_sb, BCH_FEATURE_GZIP) &&
+	    !bch_sb_test_feature(c->disk_sb, BCH_FEATURE_ZSTD))
 		return 0;
 
 	if (!mempool_initialized(&c->compression_bounce[READ])) {
@@ -489,6 +1001,14 @@ int bch_fs_compress_init(struct bch_fs *c)
 			return ret;
 	}
 
+	if (!mempool_initialized(&c->zstd_workspace_pool) &&
+	    bch_sb_test_feature(c->disk_sb, BCH_FEATURE_ZSTD)) {
+		ret = mempool_init_kmalloc_pool(&c->zstd_workspace_pool,
+						1, ZSTD_WORKSPACE_SIZE(c));
+		if (ret)
+			return ret;
+	}
+
 	if (!c->zlib_workspace &&
 	    bch_sb_test_feature(c->disk_sb, BCH_FEATURE_GZIP)) {
 		c->zlib_workspace = vmalloc(COMPRESSION_WORKSPACE_SIZE);
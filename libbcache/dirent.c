@@ -23,13 +23,20 @@ unsigned bch_dirent_name_bytes(struct bkey_s_c_dirent d)
 static u64 bch_dirent_hash(const struct bch_hash_info *info,
 			   const struct qstr *name)
 {
-	struct bch_str_hash_ctx ctx;
+	/* [0,2) reserved for dots */
+	return max_t(u64, bch_str_hash(info, name->name, name->len), 2);
+}
 
-	bch_str_hash_init(&ctx, info);
-	bch_str_hash_update(&ctx, info, name->name, name->len);
+void bch_dirent_hash_multi(const struct bch_hash_info *info,
+			   const void * const *name, const size_t *len,
+			   u64 *out, unsigned nr)
+{
+	unsigned i;
 
-	/* [0,2) reserved for dots */
-	return max_t(u64, bch_str_hash_end(&ctx, info), 2);
+	bch_str_hash_multi(info, name, len, out, nr);
+
+	for (i = 0; i < nr; i++)
+		out[i] = max_t(u64, out[i], 2);
 }
 
 static u64 dirent_hash_key(const struct bch_hash_info *info, const void *key)
@@ -10,6 +10,8 @@ struct bch_fs;
 struct bch_hash_info;
 
 unsigned bch_dirent_name_bytes(struct bkey_s_c_dirent);
+void bch_dirent_hash_multi(const struct bch_hash_info *, const void * const *,
+			   const size_t *, u64 *, unsigned);
 int bch_dirent_create(struct bch_fs *c, u64, const struct bch_hash_info *,
 		      u8, const struct qstr *, u64, u64 *, int);
 int bch_dirent_delete(struct bch_fs *, u64, const struct bch_hash_info *,
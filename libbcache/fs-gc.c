@@ -10,6 +10,7 @@
 #include "super.h"
 
 #include <linux/generic-radix-tree.h>
+#include <linux/limits.h>
 
 #define QSTR(n) { { { .len = strlen(n) } }, .name = n }
 
@@ -153,18 +154,157 @@ fsck_err:
 	return bch_btree_iter_unlock(&iter) ?: ret;
 }
 
+/*
+ * Dirents are checked against the hash of their name in batches, so that
+ * several names can be hashed at once:
+ */
+#define DIRENT_HASH_BATCH	16
+
+struct dirent_hash_batch {
+	u64			inum;
+	struct bch_hash_info	info;
+	bool			have_info;
+
+	unsigned		nr;
+	u64			offset[DIRENT_HASH_BATCH];
+	u64			d_inum[DIRENT_HASH_BATCH];
+	u8			d_type[DIRENT_HASH_BATCH];
+	const void		*name[DIRENT_HASH_BATCH];
+	size_t			len[DIRENT_HASH_BATCH];
+	char			buf[DIRENT_HASH_BATCH][NAME_MAX];
+
+	/* dirents to move to the slot they hash to, once the walk is done: */
+	struct list_head	rehash;
+};
+
+struct dirent_rehash {
+	struct list_head	list;
+	u64			dir;
+	u64			offset;
+	u64			d_inum;
+	u8			d_type;
+	unsigned		len;
+	char			name[];
+};
+
+static int dirent_hash_batch_flush(struct bch_fs *c,
+				   struct dirent_hash_batch *b)
+{
+	u64 hash[DIRENT_HASH_BATCH];
+	struct dirent_rehash *r;
+	unsigned i;
+	int ret = 0;
+
+	bch_dirent_hash_multi(&b->info, b->name, b->len, hash, b->nr);
+
+	/* A dirent can be past the slot it hashes to, but never before it: */
+	for (i = 0; i < b->nr; i++)
+		if (fsck_err_on(b->offset[i] < hash[i], c,
+				"dirent %.*s in directory %llu at offset %llu, before its hash %llu",
+				(int) b->len[i], (const char *) b->name[i],
+				b->inum, b->offset[i], hash[i])) {
+			r = kmalloc(sizeof(*r) + b->len[i], GFP_KERNEL);
+			if (!r) {
+				ret = -ENOMEM;
+				break;
+			}
+
+			r->dir		= b->inum;
+			r->offset	= b->offset[i];
+			r->d_inum	= b->d_inum[i];
+			r->d_type	= b->d_type[i];
+			r->len		= b->len[i];
+			memcpy(r->name, b->name[i], b->len[i]);
+			list_add_tail(&r->list, &b->rehash);
+		}
+fsck_err:
+	b->nr = 0;
+	return ret;
+}
+
+static int dirent_hash_batch_add(struct bch_fs *c,
+				 struct dirent_hash_batch *b,
+				 struct bkey_s_c_dirent d, u8 d_type)
+{
+	unsigned len = bch_dirent_name_bytes(d);
+
+	if (!b->have_info)
+		return 0;
+
+	b->offset[b->nr]	= d.k->p.offset;
+	b->d_inum[b->nr]	= le64_to_cpu(d.v->d_inum);
+	b->d_type[b->nr]	= d_type;
+	b->len[b->nr]		= len;
+
+	if (len > NAME_MAX) {
+		/* Too big to copy, check it now while the key is locked: */
+		b->name[b->nr++] = d.v->d_name;
+		return dirent_hash_batch_flush(c, b);
+	}
+
+	memcpy(b->buf[b->nr], d.v->d_name, len);
+	b->name[b->nr] = b->buf[b->nr];
+	b->nr++;
+
+	return b->nr == DIRENT_HASH_BATCH
+		? dirent_hash_batch_flush(c, b)
+		: 0;
+}
+
+/*
+ * Lookups start at the slot a name hashes to, so they can't find a dirent
+ * that's before it: replace the dirent with a whiteout, so that lookups of
+ * other names still probe past its slot, and recreate it where it belongs.
+ */
+static int dirent_rehash(struct bch_fs *c, struct dirent_rehash *r)
+{
+	struct qstr name = QSTR_INIT(r->name, r->len);
+	struct bch_inode_unpacked dir_inode;
+	struct bch_hash_info dir_hash_info;
+	struct bkey_i whiteout;
+	int ret;
+
+	ret = bch_inode_find_by_inum(c, r->dir, &dir_inode);
+	if (ret)
+		return ret;
+
+	dir_hash_info = bch_hash_info_init(&dir_inode);
+
+	bkey_init(&whiteout.k);
+	whiteout.k.type	= BCH_DIRENT_WHITEOUT;
+	whiteout.k.p	= POS(r->dir, r->offset);
+
+	ret = bch_btree_insert(c, BTREE_ID_DIRENTS, &whiteout, NULL,
+			       NULL, NULL, BTREE_INSERT_NOFAIL);
+	if (ret)
+		return ret;
+
+	ret = bch_dirent_create(c, r->dir, &dir_hash_info, r->d_type, &name,
+				r->d_inum, NULL, BCH_HASH_SET_MUST_CREATE);
+
+	/* A correctly hashed dirent of the same name wins: */
+	return ret != -EEXIST ? ret : 0;
+}
+
 /*
  * Walk dirents: verify that they all have a corresponding S_ISDIR inode,
- * validate d_type
+ * that they're not before the slot they hash to, validate d_type
  */
 noinline_for_stack
 static int check_dirents(struct bch_fs *c)
 {
 	struct inode_walker w = inode_walker_init();
+	struct dirent_hash_batch *hb;
 	struct btree_iter iter;
 	struct bkey_s_c k;
 	int ret = 0;
 
+	hb = kzalloc(sizeof(*hb), GFP_KERNEL);
+	if (!hb)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&hb->rehash);
+
 	for_each_btree_key(&iter, c, BTREE_ID_DIRENTS,
 			   POS(BCACHE_ROOT_INO, 0), k) {
 		struct bkey_s_c_dirent d;
@@ -184,6 +324,18 @@ static int check_dirents(struct bch_fs *c)
 				      "dirent in non directory inode %llu, type %u",
 				      k.k->p.inode, mode_to_type(w.inode.i_mode));
 
+		if (w.first_this_inode) {
+			ret = dirent_hash_batch_flush(c, hb);
+			if (ret)
+				goto err;
+
+			hb->inum	= k.k->p.inode;
+			hb->have_info	= w.have_inode &&
+				S_ISDIR(w.inode.i_mode);
+			if (hb->have_info)
+				hb->info = bch_hash_info_init(&w.inode);
+		}
+
 		if (k.k->type != BCH_DIRENT)
 			continue;
 
@@ -214,6 +366,11 @@ static int check_dirents(struct bch_fs *c)
 			continue;
 		}
 
+		ret = dirent_hash_batch_add(c, hb, d,
+				mode_to_type(le16_to_cpu(target.i_mode)));
+		if (ret)
+			goto err;
+
 		if (fsck_err_on(have_target &&
 				d.v->d_type !=
 				mode_to_type(le16_to_cpu(target.i_mode)), c,
@@ -241,9 +398,26 @@ static int check_dirents(struct bch_fs *c)
 
 		}
 	}
+
+	if (!ret)
+		ret = dirent_hash_batch_flush(c, hb);
 err:
 fsck_err:
-	return bch_btree_iter_unlock(&iter) ?: ret;
+	ret = bch_btree_iter_unlock(&iter) ?: ret;
+
+	while (!list_empty(&hb->rehash)) {
+		struct dirent_rehash *r =
+			list_first_entry(&hb->rehash, struct dirent_rehash, list);
+
+		if (!ret)
+			ret = dirent_rehash(c, r);
+
+		list_del(&r->list);
+		kfree(r);
+	}
+
+	kfree(hb);
+	return ret;
 }
 
 /*
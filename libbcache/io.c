@@ -421,6 +421,192 @@ static void init_append_extent(struct bch_write_op *op,
 	bch_keylist_push(&op->insert_keys);
 }
 
+static void bch_write_compress_fragment(struct bch_write_op *op,
+					struct bio *dst, size_t *dst_len,
+					struct bio *src, size_t *src_len,
+					unsigned *compression_type,
+					unsigned csum_type, unsigned crc_nonce,
+					struct bch_csum *csum)
+{
+	struct bch_fs *c = op->c;
+	struct nonce nonce;
+
+	bch_bio_compress(c, op->wp, dst, dst_len, src, src_len,
+			 compression_type);
+
+	BUG_ON(!*dst_len || *dst_len > dst->bi_iter.bi_size);
+	BUG_ON(!*src_len || *src_len > src->bi_iter.bi_size);
+	BUG_ON(*dst_len & (block_bytes(c) - 1));
+	BUG_ON(*src_len & (block_bytes(c) - 1));
+
+	swap(dst->bi_iter.bi_size, *dst_len);
+	nonce = extent_nonce(op->version, crc_nonce,
+			     *src_len >> 9, *compression_type);
+
+	bch_encrypt_bio(c, csum_type, nonce, dst);
+
+	*csum = bch_checksum_bio(c, csum_type, nonce, dst);
+	swap(dst->bi_iter.bi_size, *dst_len);
+}
+
+/*
+ * Big writes are compressed in parallel, on system_unbound_wq: they're split
+ * into BCH_ENCODED_EXTENT_MAX chunks, which would each be their own extent
+ * anyways. Each chunk is compressed, encrypted and checksummed into its own
+ * region of the output bio, and afterwards the output bio's bvecs are
+ * rewritten to pack the chunks together - so nothing is copied twice.
+ *
+ * The write point's compression backoff state is just a hint - it doesn't
+ * matter if chunks race updating it.
+ *
+ * As with checksumming big bios, the first chunk is done by the caller, and
+ * then any chunks that a worker hasn't picked up yet.
+ */
+#define WRITE_CHUNK_BYTES	(BCH_ENCODED_EXTENT_MAX << 9)
+#define WRITE_CHUNKS_MAX	16U
+
+struct write_chunk {
+	struct work_struct	work;
+	struct bch_write_op	*op;
+	struct bio		src;
+	struct bio		dst;
+	unsigned		csum_type;
+	unsigned		crc_nonce;
+	unsigned		compression_type;
+	size_t			src_len;
+	size_t			dst_len;
+	struct bch_csum		csum;
+};
+
+static void write_chunk_work(struct work_struct *work)
+{
+	struct write_chunk *ch = container_of(work, struct write_chunk, work);
+
+	bch_write_compress_fragment(ch->op, &ch->dst, &ch->dst_len,
+				    &ch->src, &ch->src_len,
+				    &ch->compression_type,
+				    ch->csum_type, ch->crc_nonce, &ch->csum);
+}
+
+static unsigned write_nr_chunks(struct bch_write_op *op, struct bio *orig,
+				unsigned output_available)
+{
+	unsigned nr;
+
+	if (num_online_cpus() == 1 ||
+	    op->compression_type == BCH_COMPRESSION_NONE)
+		return 1;
+
+	/* Every chunk needs room for its output if it doesn't compress: */
+	nr = output_available == orig->bi_iter.bi_size
+		? DIV_ROUND_UP(output_available, WRITE_CHUNK_BYTES)
+		: output_available / WRITE_CHUNK_BYTES;
+
+	return min(nr, WRITE_CHUNKS_MAX);
+}
+
+/*
+ * Returns the number of bytes of output, or 0 if we couldn't allocate and the
+ * caller should compress serially:
+ */
+static unsigned bch_write_compress_chunks(struct bch_write_op *op,
+					  struct open_bucket *ob,
+					  struct bio *orig, struct bio *bio,
+					  unsigned nr, unsigned csum_type,
+					  unsigned compression_type,
+					  unsigned crc_nonce)
+{
+	struct bch_fs *c = op->c;
+	struct bvec_iter src_iter = orig->bi_iter;
+	struct bvec_iter dst_iter = bio->bi_iter;
+	struct write_chunk *chunks;
+	unsigned i, done, vcnt = 0, total_output = 0;
+	unsigned pages_per_chunk = WRITE_CHUNK_BYTES / PAGE_SIZE;
+
+	BUILD_BUG_ON(WRITE_CHUNK_BYTES % PAGE_SIZE);
+
+	if (bch_keylist_realloc(&op->insert_keys,
+				op->inline_keys,
+				ARRAY_SIZE(op->inline_keys),
+				BKEY_EXTENT_U64s_MAX * nr))
+		return 0;
+
+	chunks = kmalloc_array(nr, sizeof(*chunks), GFP_NOIO);
+	if (!chunks)
+		return 0;
+
+	for (i = 0; i < nr; i++) {
+		struct write_chunk *ch = &chunks[i];
+
+		ch->op			= op;
+		ch->csum_type		= csum_type;
+		ch->crc_nonce		= crc_nonce;
+		ch->compression_type	= compression_type;
+
+		bio_init(&ch->src);
+		__bio_clone_fast(&ch->src, orig);
+		ch->src.bi_iter		= src_iter;
+		ch->src.bi_iter.bi_size	= min(src_iter.bi_size,
+					      WRITE_CHUNK_BYTES);
+		bio_advance_iter(orig, &src_iter, ch->src.bi_iter.bi_size);
+
+		bio_init(&ch->dst);
+		__bio_clone_fast(&ch->dst, bio);
+		ch->dst.bi_iter		= dst_iter;
+		ch->dst.bi_iter.bi_size	= min(dst_iter.bi_size,
+					      WRITE_CHUNK_BYTES);
+		bio_advance_iter(bio, &dst_iter, ch->dst.bi_iter.bi_size);
+
+		INIT_WORK(&ch->work, write_chunk_work);
+		if (i)
+			queue_work(system_unbound_wq, &ch->work);
+	}
+
+	write_chunk_work(&chunks[0].work);
+
+	for (i = 1; i < nr; i++)
+		if (cancel_work_sync(&chunks[i].work))
+			write_chunk_work(&chunks[i].work);
+
+	for (done = 0; done < nr; ) {
+		struct write_chunk *ch = &chunks[done++];
+
+		init_append_extent(op,
+				   ch->dst_len >> 9, ch->src_len >> 9,
+				   ch->compression_type,
+				   crc_nonce, ch->csum, csum_type, ob);
+
+		total_output += ch->dst_len;
+		bio_advance(orig, ch->src_len);
+
+		/* Later chunks only line up if this one took all its input: */
+		if (ch->src_len != ch->src.bi_iter.bi_size)
+			break;
+	}
+
+	/*
+	 * Pack the output - keep the pages each chunk wrote to, in order, and
+	 * free the rest:
+	 */
+	for (i = 0; i < bio->bi_vcnt; i++) {
+		struct bio_vec bv = bio->bi_io_vec[i];
+		unsigned chunk = i / pages_per_chunk;
+		unsigned offset = (i % pages_per_chunk) * PAGE_SIZE;
+
+		if (chunk < done && offset < chunks[chunk].dst_len) {
+			bv.bv_len = min_t(unsigned, PAGE_SIZE,
+					  chunks[chunk].dst_len - offset);
+			bio->bi_io_vec[vcnt++] = bv;
+		} else {
+			mempool_free(bv.bv_page, &c->bio_bounce_pages);
+		}
+	}
+	bio->bi_vcnt = vcnt;
+
+	kfree(chunks);
+	return total_output;
+}
+
 static int bch_write_extent(struct bch_write_op *op,
 			    struct open_bucket *ob,
 			    struct bio *orig)
@@ -474,8 +660,7 @@ static int bch_write_extent(struct bch_write_op *op,
 			min(ob->sectors_free << 9, orig->bi_iter.bi_size);
 		unsigned crc_nonce = bch_csum_type_is_encryption(csum_type)
 			? op->nonce : 0;
-		struct bch_csum csum;
-		struct nonce nonce;
+		unsigned nr = write_nr_chunks(op, orig, output_available);
 
 		bio = bio_alloc_bioset(GFP_NOIO,
 				       DIV_ROUND_UP(output_available, PAGE_SIZE),
@@ -493,58 +678,52 @@ static int bch_write_extent(struct bch_write_op *op,
 		wbio->bounce		= true;
 		wbio->put_bio		= true;
 
-		do {
-			unsigned fragment_compression_type = compression_type;
-			size_t dst_len, src_len;
-
-			bch_bio_compress(c, bio, &dst_len,
-					 orig, &src_len,
-					 &fragment_compression_type);
-
-			BUG_ON(!dst_len || dst_len > bio->bi_iter.bi_size);
-			BUG_ON(!src_len || src_len > orig->bi_iter.bi_size);
-			BUG_ON(dst_len & (block_bytes(c) - 1));
-			BUG_ON(src_len & (block_bytes(c) - 1));
-
-			swap(bio->bi_iter.bi_size, dst_len);
-			nonce = extent_nonce(op->version,
-					     crc_nonce,
-					     src_len >> 9,
-					     compression_type),
-
-			bch_encrypt_bio(c, csum_type, nonce, bio);
-
-			csum = bch_checksum_bio(c, csum_type, nonce, bio);
-			swap(bio->bi_iter.bi_size, dst_len);
-
-			init_append_extent(op,
-					   dst_len >> 9, src_len >> 9,
-					   fragment_compression_type,
-					   crc_nonce, csum, csum_type, ob);
-
-			total_output += dst_len;
-			bio_advance(bio, dst_len);
-			bio_advance(orig, src_len);
-		} while (bio->bi_iter.bi_size &&
-			 orig->bi_iter.bi_size &&
-			 !bch_keylist_realloc(&op->insert_keys,
-					      op->inline_keys,
-					      ARRAY_SIZE(op->inline_keys),
-					      BKEY_EXTENT_U64s_MAX));
+		if (nr > 1)
+			total_output = bch_write_compress_chunks(op, ob, orig, bio,
+					nr, csum_type, compression_type,
+					crc_nonce);
+
+		if (!total_output) {
+			do {
+				unsigned fragment_compression_type =
+					compression_type;
+				size_t dst_len, src_len;
+				struct bch_csum csum;
+
+				bch_write_compress_fragment(op, bio, &dst_len,
+						orig, &src_len,
+						&fragment_compression_type,
+						csum_type, crc_nonce, &csum);
+
+				init_append_extent(op,
+						   dst_len >> 9, src_len >> 9,
+						   fragment_compression_type,
+						   crc_nonce, csum, csum_type, ob);
+
+				total_output += dst_len;
+				bio_advance(bio, dst_len);
+				bio_advance(orig, src_len);
+			} while (bio->bi_iter.bi_size &&
+				 orig->bi_iter.bi_size &&
+				 !bch_keylist_realloc(&op->insert_keys,
+						      op->inline_keys,
+						      ARRAY_SIZE(op->inline_keys),
+						      BKEY_EXTENT_U64s_MAX));
+
+			/*
+			 * Free unneeded pages after compressing:
+			 */
+			while (bio->bi_vcnt * PAGE_SIZE >
+			       round_up(total_output, PAGE_SIZE))
+				mempool_free(bio->bi_io_vec[--bio->bi_vcnt].bv_page,
+					     &c->bio_bounce_pages);
+		}
 
 		BUG_ON(total_output > output_available);
 
 		memset(&bio->bi_iter, 0, sizeof(bio->bi_iter));
 		bio->bi_iter.bi_size = total_output;
 
-		/*
-		 * Free unneeded pages after compressing:
-		 */
-		while (bio->bi_vcnt * PAGE_SIZE >
-		       round_up(bio->bi_iter.bi_size, PAGE_SIZE))
-			mempool_free(bio->bi_io_vec[--bio->bi_vcnt].bv_page,
-				     &c->bio_bounce_pages);
-
 		ret = orig->bi_iter.bi_size != 0;
 	} else {
 		bio = bio_next_split(orig, ob->sectors_free, GFP_NOIO,
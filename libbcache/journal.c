@@ -1458,6 +1458,31 @@ void bch_journal_start(struct bch_fs *c)
 	queue_delayed_work(system_freezable_wq, &j->reclaim_work, 0);
 }
 
+static int bch_journal_replay_keys(struct bch_fs *c, enum btree_id id,
+				   struct keylist *keys)
+{
+	struct disk_reservation disk_res;
+	struct btree_iter iter;
+	int ret;
+
+	/*
+	 * We might cause compressed extents to be split, so we need to pass in
+	 * a disk_reservation:
+	 */
+	BUG_ON(bch_disk_reservation_get(c, &disk_res, 0, 0));
+
+	bch_btree_iter_init_intent(&iter, c, id,
+			bkey_start_pos(&bch_keylist_front(keys)->k));
+
+	ret = bch_btree_insert_list_at(&iter, keys, &disk_res, NULL, NULL,
+				       BTREE_INSERT_NOFAIL|
+				       BTREE_INSERT_JOURNAL_REPLAY);
+	bch_btree_iter_unlock(&iter);
+	bch_disk_reservation_put(c, &disk_res);
+
+	return ret;
+}
+
 int bch_journal_replay(struct bch_fs *c, struct list_head *list)
 {
 	int ret = 0, keys = 0, entries = 0;
@@ -1465,6 +1490,11 @@ int bch_journal_replay(struct bch_fs *c, struct list_head *list)
 	struct bkey_i *k, *_n;
 	struct jset_entry *entry;
 	struct journal_replay *i, *n;
+	struct keylist run;
+	enum btree_id run_id = 0;
+	struct bpos run_end = POS_MIN;
+
+	bch_keylist_init(&run, NULL, 0);
 
 	list_for_each_entry_safe(i, n, list, list) {
 		j->cur_pin_list =
@@ -1473,30 +1503,41 @@ int bch_journal_replay(struct bch_fs *c, struct list_head *list)
 					le64_to_cpu(i->j.seq))) &
 				      j->pin.mask)];
 
+		/*
+		 * Keys are replayed in runs: consecutive keys for the same
+		 * btree in increasing order get inserted together:
+		 */
 		for_each_jset_key(k, _n, entry, &i->j) {
-			struct disk_reservation disk_res;
-
-			/*
-			 * We might cause compressed extents to be split, so we
-			 * need to pass in a disk_reservation:
-			 */
-			BUG_ON(bch_disk_reservation_get(c, &disk_res, 0, 0));
-
 			trace_bcache_journal_replay_key(&k->k);
 
-			ret = bch_btree_insert(c, entry->btree_id, k,
-					       &disk_res, NULL, NULL,
-					       BTREE_INSERT_NOFAIL|
-					       BTREE_INSERT_JOURNAL_REPLAY);
-			bch_disk_reservation_put(c, &disk_res);
+			if (!bch_keylist_empty(&run) &&
+			    (entry->btree_id != run_id ||
+			     bkey_cmp(k->k.p, run_end) <= 0 ||
+			     bkey_cmp(bkey_start_pos(&k->k), run_end) < 0)) {
+				ret = bch_journal_replay_keys(c, run_id, &run);
+				if (ret)
+					goto err;
 
-			if (ret)
+				cond_resched();
+			}
+
+			if (bch_keylist_realloc(&run, NULL, 0, k->k.u64s)) {
+				ret = -ENOMEM;
 				goto err;
+			}
 
-			cond_resched();
+			bch_keylist_add(&run, k);
+			run_id	= entry->btree_id;
+			run_end	= k->k.p;
 			keys++;
 		}
 
+		if (!bch_keylist_empty(&run)) {
+			ret = bch_journal_replay_keys(c, run_id, &run);
+			if (ret)
+				goto err;
+		}
+
 		if (atomic_dec_and_test(&j->cur_pin_list->count))
 			wake_up(&j->wait);
 
@@ -1525,6 +1566,7 @@ err:
 	if (ret)
 		bch_err(c, "journal replay error: %d", ret);
 
+	bch_keylist_free(&run, NULL);
 	bch_journal_entries_free(list);
 
 	return ret;
@@ -1892,6 +1934,27 @@ static bool should_discard_bucket(struct journal *j, struct journal_device *ja)
 	return ret;
 }
 
+/*
+ * Number of buckets starting at last_idx that can be discarded together - they
+ * all have to be reclaimable, and contiguous on the device:
+ */
+static unsigned journal_discard_run(struct journal *j,
+				    struct journal_device *ja)
+{
+	unsigned idx = ja->last_idx, nr = 0;
+
+	spin_lock(&j->lock);
+	do {
+		nr++;
+		idx = (idx + 1) % ja->nr;
+	} while (idx != ja->cur_idx &&
+		 ja->bucket_seq[idx] < j->last_seq_ondisk &&
+		 ja->buckets[idx] == ja->buckets[ja->last_idx] + nr);
+	spin_unlock(&j->lock);
+
+	return nr;
+}
+
 /**
  * journal_reclaim_work - free up journal buckets
  *
@@ -1918,7 +1981,7 @@ static void journal_reclaim_work(struct work_struct *work)
 	struct bch_dev *ca;
 	struct journal_entry_pin *pin;
 	u64 seq_to_flush = 0;
-	unsigned iter, bucket_to_flush;
+	unsigned iter, bucket_to_flush, nr_discard;
 	unsigned long next_flush;
 	bool reclaim_lock_held = false, need_flush;
 
@@ -1949,15 +2012,18 @@ static void journal_reclaim_work(struct work_struct *work)
 				continue;
 			}
 
+			nr_discard = journal_discard_run(j, ja);
+
 			if (ca->mi.discard &&
 			    blk_queue_discard(bdev_get_queue(ca->disk_sb.bdev)))
 				blkdev_issue_discard(ca->disk_sb.bdev,
 					bucket_to_sector(ca,
 						ja->buckets[ja->last_idx]),
-					ca->mi.bucket_size, GFP_NOIO, 0);
+					ca->mi.bucket_size * nr_discard,
+					GFP_NOIO, 0);
 
 			spin_lock(&j->lock);
-			ja->last_idx = (ja->last_idx + 1) % ja->nr;
+			ja->last_idx = (ja->last_idx + nr_discard) % ja->nr;
 			spin_unlock(&j->lock);
 
 			wake_up(&j->wait);
@@ -2164,6 +2230,15 @@ static void journal_write_done(struct closure *cl)
 
 	j->last_seq_ondisk = le64_to_cpu(w->data->last_seq);
 
+	/*
+	 * Updating last_seq_ondisk may let journal_reclaim_work() discard more
+	 * buckets.
+	 *
+	 * This has to happen before we signal that the write is done: once it
+	 * has, bch_fs_journal_stop() may already be cancelling reclaim_work:
+	 */
+	mod_delayed_work(system_freezable_wq, &j->reclaim_work, 0);
+
 	__bch_time_stats_update(j->write_time, j->write_start_time);
 
 	BUG_ON(!j->reservations.prev_buf_unwritten);
@@ -2187,12 +2262,6 @@ static void journal_write_done(struct closure *cl)
 
 	closure_wake_up(&w->wait);
 	wake_up(&j->wait);
-
-	/*
-	 * Updating last_seq_ondisk may let journal_reclaim_work() discard more
-	 * buckets:
-	 */
-	mod_delayed_work(system_freezable_wq, &j->reclaim_work, 0);
 }
 
 static void journal_write(struct closure *cl)
@@ -2203,6 +2272,7 @@ static void journal_write(struct closure *cl)
 	struct journal_buf *w = journal_prev_buf(j);
 	struct jset *jset = w->data;
 	struct bio *bio;
+	struct blk_plug plug;
 	struct bch_extent_ptr *ptr;
 	unsigned i, sectors, bytes;
 
@@ -2258,6 +2328,8 @@ static void journal_write(struct closure *cl)
 	if (c->opts.nochanges)
 		goto no_io;
 
+	blk_start_plug(&plug);
+
 	extent_for_each_ptr(bkey_i_to_s_extent(&j->key), ptr) {
 		ca = c->devs[ptr->dev];
 		if (!percpu_ref_tryget(&ca->io_ref)) {
@@ -2299,6 +2371,7 @@ static void journal_write(struct closure *cl)
 			closure_bio_submit_punt(bio, cl, c);
 		}
 
+	blk_finish_plug(&plug);
 no_io:
 	extent_for_each_ptr(bkey_i_to_s_extent(&j->key), ptr)
 		ptr->offset += sectors;
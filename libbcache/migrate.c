@@ -91,6 +91,7 @@ int bch_move_data_off_device(struct bch_dev *ca)
 
 	do {
 		struct btree_iter iter;
+		struct blk_plug plug;
 		struct bkey_s_c k;
 
 		seen_key_count = 0;
@@ -98,6 +99,7 @@ int bch_move_data_off_device(struct bch_dev *ca)
 		atomic_set(&ctxt.error_flags, 0);
 
 		bch_btree_iter_init(&iter, c, BTREE_ID_EXTENTS, POS_MIN);
+		blk_start_plug(&plug);
 
 		while (!bch_move_ctxt_wait(&ctxt) &&
 		       (k = bch_btree_iter_peek(&iter)).k &&
@@ -128,6 +130,7 @@ next:
 			bch_btree_iter_cond_resched(&iter);
 
 		}
+		blk_finish_plug(&plug);
 		bch_btree_iter_unlock(&iter);
 		bch_move_ctxt_exit(&ctxt);
 
@@ -62,6 +62,7 @@ static void read_moving(struct bch_dev *ca, size_t buckets_to_move,
 	struct bucket *g;
 	struct moving_context ctxt;
 	struct btree_iter iter;
+	struct blk_plug plug;
 	struct bkey_s_c k;
 	u64 sectors_not_moved = 0;
 	size_t buckets_not_moved = 0;
@@ -70,6 +71,7 @@ static void read_moving(struct bch_dev *ca, size_t buckets_to_move,
 	bch_move_ctxt_init(&ctxt, &ca->moving_gc_pd.rate,
 				SECTORS_IN_FLIGHT_PER_DEVICE);
 	bch_btree_iter_init(&iter, c, BTREE_ID_EXTENTS, POS_MIN);
+	blk_start_plug(&plug);
 
 	while (1) {
 		if (kthread_should_stop())
@@ -101,6 +103,7 @@ next:
 		cond_resched();
 	}
 
+	blk_finish_plug(&plug);
 	bch_btree_iter_unlock(&iter);
 	bch_move_ctxt_exit(&ctxt);
 	trace_bcache_moving_gc_end(ca, ctxt.sectors_moved, ctxt.keys_moved,
@@ -119,6 +122,7 @@ next:
 			 buckets_not_moved, buckets_to_move);
 	return;
 out:
+	blk_finish_plug(&plug);
 	bch_btree_iter_unlock(&iter);
 	bch_move_ctxt_exit(&ctxt);
 	trace_bcache_moving_gc_end(ca, ctxt.sectors_moved, ctxt.keys_moved,
@@ -22,6 +22,7 @@ const char * const bch_compression_types[] = {
 	"none",
 	"lz4",
 	"gzip",
+	"zstd",
 	NULL
 };
 
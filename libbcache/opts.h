@@ -65,6 +65,8 @@ enum opt_type {
 		s8,  OPT_STR(bch_csum_types))				\
 	BCH_OPT(compression,		0644,	BCH_SB_COMPRESSION_TYPE,\
 		s8,  OPT_STR(bch_compression_types))			\
+	BCH_OPT(zstd_level,		0444,	BCH_SB_ZSTD_LEVEL,	\
+		s8,  OPT_UINT(1, 22))					\
 	BCH_OPT(str_hash,		0644,	BCH_SB_STR_HASH_TYPE,	\
 		s8,  OPT_STR(bch_str_hash_types))			\
 	BCH_OPT(inodes_32bit,		0644,	BCH_SB_INODE_32BIT,	\
@@ -93,6 +95,10 @@ enum opt_type {
 		s8,  OPT_BOOL())					\
 	BCH_OPT(noexcl,			0444,	NO_SB_OPT,		\
 		s8,  OPT_BOOL())					\
+	BCH_OPT(btree_readahead,	0644,	NO_SB_OPT,		\
+		s8,  OPT_UINT(0, 64))					\
+	BCH_OPT(btree_cache_size,	0644,	NO_SB_OPT,		\
+		s64, OPT_UINT(0, S64_MAX))				\
 	BCH_OPT(sb,			0444,	NO_SB_OPT,		\
 		s64, OPT_UINT(0, S64_MAX))				\
 
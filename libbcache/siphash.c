@@ -162,11 +162,223 @@ u64 SipHash_End(SIPHASH_CTX *ctx, int rc, int rf)
 	return (r);
 }
 
+#define SIP_ROTL(x, b)	(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND(v0, v1, v2, v3)					\
+do {									\
+	v0 += v1; v2 += v3;						\
+	v1 = SIP_ROTL(v1, 13); v3 = SIP_ROTL(v3, 16);			\
+	v1 ^= v0; v3 ^= v2;						\
+	v0 = SIP_ROTL(v0, 32);						\
+	v2 += v1; v0 += v3;						\
+	v1 = SIP_ROTL(v1, 17); v3 = SIP_ROTL(v3, 21);			\
+	v1 ^= v2; v3 ^= v0;						\
+	v2 = SIP_ROTL(v2, 32);						\
+} while (0)
+
+/*
+ * Block @i of a message, as SipHash_Update()/SipHash_End() would feed it in -
+ * the last block has the tail of the message and the length in the top byte:
+ */
+static inline u64 SipHash_Block(const u8 *p, size_t len, size_t i)
+{
+	u64 m;
+
+	if (i < len / 8)
+		return get_unaligned_le64(p + i * 8);
+	if (i > len / 8)
+		return 0;
+
+	p += i * 8;
+	m = (u64) len << 56;
+
+	switch (len & 7) {
+	case 7: m |= (u64) p[6] << 48;
+	case 6: m |= (u64) p[5] << 40;
+	case 5: m |= (u64) p[4] << 32;
+	case 4: m |= (u64) get_unaligned_le32(p);
+		break;
+	case 3: m |= (u64) p[2] << 16;
+	case 2: m |= (u64) p[1] << 8;
+	case 1: m |= (u64) p[0];
+	}
+
+	return m;
+}
+
+/*
+ * One shot version, for when the whole message is in one buffer - same result
+ * as SipHash_Init/Update/End, but keeps the state in registers:
+ */
 u64 SipHash(const SIPHASH_KEY *key, int rc, int rf, const void *src, size_t len)
 {
-	SIPHASH_CTX ctx;
+	u64 k0 = le64_to_cpu(key->k0);
+	u64 k1 = le64_to_cpu(key->k1);
+	u64 v0 = 0x736f6d6570736575ULL ^ k0;
+	u64 v1 = 0x646f72616e646f6dULL ^ k1;
+	u64 v2 = 0x6c7967656e657261ULL ^ k0;
+	u64 v3 = 0x7465646279746573ULL ^ k1;
+	size_t i;
+	int r;
+
+	for (i = 0; i <= len / 8; i++) {
+		u64 m = SipHash_Block(src, len, i);
+
+		v3 ^= m;
+		for (r = 0; r < rc; r++)
+			SIPROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	v2 ^= 0xff;
+	for (r = 0; r < rf; r++)
+		SIPROUND(v0, v1, v2, v3);
+
+	return (v0 ^ v1) ^ (v2 ^ v3);
+}
+
+#define SIPHASH_LANES_MAX_LEN		255
+#define SIPHASH_LANES_MAX_BLOCKS	(SIPHASH_LANES_MAX_LEN / 8 + 1)
+
+#ifdef __x86_64__
+
+/*
+ * Multiple messages at once: a single SipHash is one long dependency chain, so
+ * with AVX2 we run SIPHASH_LANES of them side by side in vector registers.
+ * Lanes that have run out of blocks keep their state until the longest message
+ * is done, then all lanes finalize together.
+ *
+ * This is meant for filenames and xattr names - longer messages go through
+ * SipHash():
+ */
+typedef u64 siphash_lanes __attribute__((vector_size(SIPHASH_LANES * sizeof(u64))));
+typedef u8 siphash_lanes_bytes __attribute__((vector_size(SIPHASH_LANES * sizeof(u64))));
+
+/* Rotates by whole bytes are a single shuffle: */
+#define SIP_ROTL_BYTES(x, b)						\
+	((siphash_lanes) __builtin_shuffle((siphash_lanes_bytes) (x),	\
+		(siphash_lanes_bytes) {					\
+		 (8 - b) % 8,  (9 - b) % 8,  (10 - b) % 8, (11 - b) % 8,	\
+		(12 - b) % 8, (13 - b) % 8, (14 - b) % 8, (15 - b) % 8,	\
+		 (8 - b) % 8 + 8,  (9 - b) % 8 + 8, (10 - b) % 8 + 8, (11 - b) % 8 + 8,\
+		(12 - b) % 8 + 8, (13 - b) % 8 + 8, (14 - b) % 8 + 8, (15 - b) % 8 + 8,\
+		 (8 - b) % 8 + 16, (9 - b) % 8 + 16, (10 - b) % 8 + 16, (11 - b) % 8 + 16,\
+		(12 - b) % 8 + 16, (13 - b) % 8 + 16, (14 - b) % 8 + 16, (15 - b) % 8 + 16,\
+		 (8 - b) % 8 + 24, (9 - b) % 8 + 24, (10 - b) % 8 + 24, (11 - b) % 8 + 24,\
+		(12 - b) % 8 + 24, (13 - b) % 8 + 24, (14 - b) % 8 + 24, (15 - b) % 8 + 24 }))
+
+#define SIPROUND_LANES(v0, v1, v2, v3)					\
+do {									\
+	v0 += v1; v2 += v3;						\
+	v1 = SIP_ROTL(v1, 13); v3 = SIP_ROTL_BYTES(v3, 2);		\
+	v1 ^= v0; v3 ^= v2;						\
+	v0 = SIP_ROTL_BYTES(v0, 4);					\
+	v2 += v1; v0 += v3;						\
+	v1 = SIP_ROTL(v1, 17); v3 = SIP_ROTL(v3, 21);			\
+	v1 ^= v2; v3 ^= v0;						\
+	v2 = SIP_ROTL_BYTES(v2, 4);					\
+} while (0)
+
+__attribute__((target("avx2")))
+static void SipHash24_lanes_avx2(const SIPHASH_KEY *key, const void * const *src,
+			    const size_t *len, u64 *out, unsigned nr)
+{
+	siphash_lanes v0, v1, v2, v3, m[SIPHASH_LANES_MAX_BLOCKS];
+	siphash_lanes active, blocks = { 0 };
+	size_t i, max_blocks = 0;
+	unsigned l;
+
+	v0 = v2 = (siphash_lanes) { 0 } + le64_to_cpu(key->k0);
+	v1 = v3 = (siphash_lanes) { 0 } + le64_to_cpu(key->k1);
+	v0 ^= 0x736f6d6570736575ULL;
+	v1 ^= 0x646f72616e646f6dULL;
+	v2 ^= 0x6c7967656e657261ULL;
+	v3 ^= 0x7465646279746573ULL;
+
+	for (l = 0; l < nr; l++) {
+		blocks[l] = len[l] / 8 + 1;
+		max_blocks = max_t(size_t, max_blocks, blocks[l]);
+	}
+
+	/* Transpose the messages into lanes up front: */
+	for (i = 0; i < max_blocks; i++)
+		for (l = 0; l < SIPHASH_LANES; l++)
+			m[i][l] = l < nr ? SipHash_Block(src[l], len[l], i) : 0;
+
+	for (i = 0; i < max_blocks; i++) {
+		siphash_lanes n0 = v0, n1 = v1, n2 = v2, n3 = v3;
+
+		n3 ^= m[i];
+		SIPROUND_LANES(n0, n1, n2, n3);
+		SIPROUND_LANES(n0, n1, n2, n3);
+		n0 ^= m[i];
+
+		active = (siphash_lanes) (i < blocks);
+		v0 = (n0 & active) | (v0 & ~active);
+		v1 = (n1 & active) | (v1 & ~active);
+		v2 = (n2 & active) | (v2 & ~active);
+		v3 = (n3 & active) | (v3 & ~active);
+	}
+
+	v2 ^= 0xff;
+	SIPROUND_LANES(v0, v1, v2, v3);
+	SIPROUND_LANES(v0, v1, v2, v3);
+	SIPROUND_LANES(v0, v1, v2, v3);
+	SIPROUND_LANES(v0, v1, v2, v3);
+
+	v0 ^= v1 ^ v2 ^ v3;
+
+	for (l = 0; l < nr; l++)
+		out[l] = v0[l];
+}
+
+#endif
+
+static void SipHash24_lanes_scalar(const SIPHASH_KEY *key,
+				   const void * const *src,
+				   const size_t *len, u64 *out, unsigned nr)
+{
+	unsigned i;
+
+	for (i = 0; i < nr; i++)
+		out[i] = SipHash24(key, src[i], len[i]);
+}
+
+static void (*SipHash24_lanes_fn)(const SIPHASH_KEY *, const void * const *,
+				  const size_t *, u64 *, unsigned) =
+	SipHash24_lanes_scalar;
+
+void SipHash24_multi(const SIPHASH_KEY *key, const void * const *src,
+		     const size_t *len, u64 *out, unsigned nr)
+{
+	unsigned i;
+
+	while (nr) {
+		unsigned n = min_t(unsigned, nr, SIPHASH_LANES);
+
+		for (i = 0; i < n; i++)
+			if (len[i] > SIPHASH_LANES_MAX_LEN)
+				break;
+
+		if (i == n)
+			SipHash24_lanes_fn(key, src, len, out, n);
+		else
+			SipHash24_lanes_scalar(key, src, len, out, n);
+
+		src	+= n;
+		len	+= n;
+		out	+= n;
+		nr	-= n;
+	}
+}
+
+__attribute__((constructor(110)))
+static void SipHash_cpu_init(void)
+{
+#ifdef __x86_64__
+	__builtin_cpu_init();
 
-	SipHash_Init(&ctx, key);
-	SipHash_Update(&ctx, rc, rf, src, len);
-	return SipHash_End(&ctx, rc, rf);
+	if (__builtin_cpu_supports("avx2"))
+		SipHash24_lanes_fn = SipHash24_lanes_avx2;
+#endif
 }
@@ -53,6 +53,7 @@
 #define SIPHASH_BLOCK_LENGTH	 8
 #define SIPHASH_KEY_LENGTH	16
 #define SIPHASH_DIGEST_LENGTH	 8
+#define SIPHASH_LANES		 4
 
 typedef struct _SIPHASH_CTX {
 	u64		v[4];
@@ -70,6 +71,8 @@ void	SipHash_Update(SIPHASH_CTX *, int, int, const void *, size_t);
 u64	SipHash_End(SIPHASH_CTX *, int, int);
 void	SipHash_Final(void *, SIPHASH_CTX *, int, int);
 u64	SipHash(const SIPHASH_KEY *, int, int, const void *, size_t);
+void	SipHash24_multi(const SIPHASH_KEY *, const void * const *,
+			const size_t *, u64 *, unsigned);
 
 #define SipHash24_Init(_c, _k)		SipHash_Init((_c), (_k))
 #define SipHash24_Update(_c, _p, _l)	SipHash_Update((_c), 2, 4, (_p), (_l))
@@ -8,6 +8,7 @@
 #include "super.h"
 
 #include <linux/crc32c.h>
+#include <linux/crc64.h>
 #include <crypto/hash.h>
 
 struct bch_hash_info {
@@ -67,7 +68,7 @@ static inline void bch_str_hash_init(struct bch_str_hash_ctx *ctx,
 		ctx->crc32c = crc32c(~0, &info->crc_key, sizeof(info->crc_key));
 		break;
 	case BCH_STR_HASH_CRC64:
-		ctx->crc64 = bch_crc64_update(~0, &info->crc_key, sizeof(info->crc_key));
+		ctx->crc64 = crc64_be(~0, &info->crc_key, sizeof(info->crc_key));
 		break;
 	case BCH_STR_HASH_SIPHASH:
 		SipHash24_Init(&ctx->siphash, &info->siphash_key);
@@ -86,7 +87,7 @@ static inline void bch_str_hash_update(struct bch_str_hash_ctx *ctx,
 		ctx->crc32c = crc32c(ctx->crc32c, data, len);
 		break;
 	case BCH_STR_HASH_CRC64:
-		ctx->crc64 = bch_crc64_update(ctx->crc64, data, len);
+		ctx->crc64 = crc64_be(ctx->crc64, data, len);
 		break;
 	case BCH_STR_HASH_SIPHASH:
 		SipHash24_Update(&ctx->siphash, data, len);
@@ -111,6 +112,48 @@ static inline u64 bch_str_hash_end(struct bch_str_hash_ctx *ctx,
 	}
 }
 
+/*
+ * The same as bch_str_hash_init/update/end, for when the string is in one
+ * buffer:
+ */
+static inline u64 bch_str_hash(const struct bch_hash_info *info,
+			       const void *data, size_t len)
+{
+	switch (info->type) {
+	case BCH_STR_HASH_SIPHASH:
+		return SipHash24(&info->siphash_key, data, len) >> 1;
+	default: {
+		struct bch_str_hash_ctx ctx;
+
+		bch_str_hash_init(&ctx, info);
+		bch_str_hash_update(&ctx, info, data, len);
+		return bch_str_hash_end(&ctx, info);
+	}
+	}
+}
+
+/* Hash @nr strings at once - siphash can do several in parallel: */
+static inline void bch_str_hash_multi(const struct bch_hash_info *info,
+				      const void * const *data,
+				      const size_t *len,
+				      u64 *out, unsigned nr)
+{
+	unsigned i;
+
+	switch (info->type) {
+	case BCH_STR_HASH_SIPHASH:
+		SipHash24_multi(&info->siphash_key, data, len, out, nr);
+
+		for (i = 0; i < nr; i++)
+			out[i] >>= 1;
+		break;
+	default:
+		for (i = 0; i < nr; i++)
+			out[i] = bch_str_hash(info, data[i], len[i]);
+		break;
+	}
+}
+
 struct bch_hash_desc {
 	enum btree_id	btree_id;
 	u8		key_type;
@@ -393,6 +393,7 @@ static void bch_fs_exit(struct bch_fs *c)
 	cancel_work_sync(&c->read_only_work);
 	cancel_work_sync(&c->bio_submit_work);
 	cancel_work_sync(&c->read_retry_work);
+	cancel_work_sync(&c->btree_cache_limit_work);
 
 	for (i = 0; i < c->sb.nr_devices; i++)
 		if (c->devs[i])
@@ -493,6 +494,9 @@ void bch_fs_stop_async(struct bch_fs *c)
 
 void bch_fs_stop(struct bch_fs *c)
 {
+	struct bch_dev *ca;
+	unsigned i;
+
 	mutex_lock(&c->state_lock);
 	BUG_ON(c->state == BCH_FS_STOPPING);
 	c->state = BCH_FS_STOPPING;
@@ -505,6 +509,19 @@ void bch_fs_stop(struct bch_fs *c)
 
 	bch_fs_offline(c);
 
+	/*
+	 * IO completions can still be running after whatever they woke up has
+	 * moved on - e.g. the last journal write has woken up the journal flush
+	 * but not yet dropped its ref on c->cl. IO completions drop their io_ref
+	 * last, so drain those before looking at c->cl:
+	 */
+	for_each_member_device(ca, c, i)
+		if (ca->disk_sb.bdev) {
+			reinit_completion(&ca->offline_complete);
+			percpu_ref_kill(&ca->io_ref);
+			wait_for_completion(&ca->offline_complete);
+		}
+
 	closure_put(&c->cl);
 	closure_sync(&c->cl);
 
@@ -555,11 +572,13 @@ static struct bch_fs *bch_fs_alloc(struct bch_sb *sb, struct bch_opts opts)
 
 	INIT_LIST_HEAD(&c->list);
 	INIT_LIST_HEAD(&c->cached_devs);
-	INIT_LIST_HEAD(&c->btree_cache);
+	INIT_LIST_HEAD(&c->btree_cache_lru[BTREE_LRU_RECENT]);
+	INIT_LIST_HEAD(&c->btree_cache_lru[BTREE_LRU_FREQUENT]);
 	INIT_LIST_HEAD(&c->btree_cache_freeable);
 	INIT_LIST_HEAD(&c->btree_cache_freed);
 
 	INIT_LIST_HEAD(&c->btree_interior_update_list);
+	INIT_LIST_HEAD(&c->btree_bulk_loads);
 	mutex_init(&c->btree_reserve_cache_lock);
 	mutex_init(&c->btree_interior_update_lock);
 
@@ -569,6 +588,7 @@ static struct bch_fs *bch_fs_alloc(struct bch_sb *sb, struct bch_opts opts)
 	bio_list_init(&c->read_retry_list);
 	spin_lock_init(&c->read_retry_lock);
 	INIT_WORK(&c->read_retry_work, bch_read_retry_work);
+	INIT_WORK(&c->btree_cache_limit_work, bch_btree_cache_limit_work);
 	mutex_init(&c->zlib_workspace_lock);
 
 	seqcount_init(&c->gc_pos_lock);
@@ -609,6 +629,8 @@ static struct bch_fs *bch_fs_alloc(struct bch_sb *sb, struct bch_opts opts)
 
 	scnprintf(c->name, sizeof(c->name), "%pU", &c->sb.user_uuid);
 
+	c->opts.btree_readahead	= 8;
+
 	bch_opts_apply(&c->opts, bch_sb_opts(sb));
 	bch_opts_apply(&c->opts, opts);
 
@@ -635,7 +657,8 @@ static struct bch_fs *bch_fs_alloc(struct bch_sb *sb, struct bch_opts opts)
 	    mempool_init_kmalloc_pool(&c->btree_interior_update_pool, 1,
 				      sizeof(struct btree_interior_update)) ||
 	    mempool_init_kmalloc_pool(&c->fill_iter, 1, iter_size) ||
-	    bioset_init(&c->btree_read_bio, 1, 0) ||
+	    bioset_init(&c->btree_read_bio, 1,
+			offsetof(struct btree_read_bio, bio)) ||
 	    bioset_init(&c->bio_read, 1, offsetof(struct bch_read_bio, bio)) ||
 	    bioset_init(&c->bio_read_split, 1, offsetof(struct bch_read_bio, bio)) ||
 	    bioset_init(&c->bio_write, 1, offsetof(struct bch_write_bio, bio)) ||
@@ -56,6 +56,7 @@ read_attribute(fragmentation_stats);
 read_attribute(oldest_gen_stats);
 read_attribute(reserve_stats);
 read_attribute(btree_cache_size);
+read_attribute(btree_cache_stats);
 read_attribute(cache_available_percent);
 read_attribute(compression_stats);
 read_attribute(written);
@@ -510,15 +511,8 @@ lock_root:
 
 static size_t bch_btree_cache_size(struct bch_fs *c)
 {
-	size_t ret = 0;
-	struct btree *b;
-
-	mutex_lock(&c->btree_cache_lock);
-	list_for_each_entry(b, &c->btree_cache, list)
-		ret += btree_bytes(c);
-
-	mutex_unlock(&c->btree_cache_lock);
-	return ret;
+	return (c->btree_cache_lru_nr[BTREE_LRU_RECENT] +
+		c->btree_cache_lru_nr[BTREE_LRU_FREQUENT]) * btree_bytes(c);
 }
 
 static unsigned bch_fs_available_percent(struct bch_fs *c)
@@ -609,12 +603,27 @@ static ssize_t bch_compression_stats(struct bch_fs *c, char *buf)
 			"compressed data:\n"
 			"	nr extents:			%llu\n"
 			"	compressed size (bytes):	%llu\n"
-			"	uncompressed size (bytes):	%llu\n",
+			"	uncompressed size (bytes):	%llu\n"
+			"compression attempts:\n"
+			"	compressed:			%llu\n"
+			"	wasted (didn't shrink):		%llu\n"
+			"	skipped (high entropy):		%llu\n"
+			"	skipped (backing off):		%llu\n"
+			"decompression:\n"
+			"	direct:				%llu\n"
+			"	bounced:			%llu\n",
 			nr_uncompressed_extents,
 			uncompressed_sectors << 9,
 			nr_compressed_extents,
 			compressed_sectors_compressed << 9,
-			compressed_sectors_uncompressed << 9);
+			compressed_sectors_uncompressed << 9,
+			(u64) (atomic64_read(&c->compress_attempted) -
+			       atomic64_read(&c->compress_wasted)),
+			(u64) atomic64_read(&c->compress_wasted),
+			(u64) atomic64_read(&c->compress_skipped_entropy),
+			(u64) atomic64_read(&c->compress_skipped_backoff),
+			(u64) atomic64_read(&c->decompress_direct),
+			(u64) atomic64_read(&c->decompress_bounced));
 }
 
 SHOW(bch_fs)
@@ -635,6 +644,9 @@ SHOW(bch_fs)
 	sysfs_hprint(btree_cache_size,		bch_btree_cache_size(c));
 	sysfs_print(cache_available_percent,	bch_fs_available_percent(c));
 
+	if (attr == &sysfs_btree_cache_stats)
+		return bch_print_btree_cache_stats(c, buf, PAGE_SIZE);
+
 	sysfs_print(btree_gc_running,		c->gc_pos.phase != GC_PHASE_DONE);
 
 #if 0
@@ -849,6 +861,7 @@ static struct attribute *bch_fs_files[] = {
 	&sysfs_tree_depth,
 	&sysfs_root_usage_percent,
 	&sysfs_btree_cache_size,
+	&sysfs_btree_cache_stats,
 	&sysfs_cache_available_percent,
 	&sysfs_compression_stats,
 
@@ -964,6 +977,9 @@ STORE(bch_fs_opts_dir)
 
 	mutex_unlock(&c->sb_lock);
 
+	if (id == Opt_btree_cache_size)
+		mca_shrink_to_limit(c, 0);
+
 	return size;
 }
 
@@ -103,6 +103,7 @@ static s64 read_tiering(struct bch_fs *c, struct bch_tier *tier)
 	struct moving_context ctxt;
 	struct tiering_state s;
 	struct btree_iter iter;
+	struct blk_plug plug;
 	struct bkey_s_c k;
 	unsigned nr_devices = READ_ONCE(tier->devs.nr);
 	int ret;
@@ -119,6 +120,7 @@ static s64 read_tiering(struct bch_fs *c, struct bch_tier *tier)
 	bch_move_ctxt_init(&ctxt, &tier->pd.rate,
 			   nr_devices * SECTORS_IN_FLIGHT_PER_DEVICE);
 	bch_btree_iter_init(&iter, c, BTREE_ID_EXTENTS, POS_MIN);
+	blk_start_plug(&plug);
 
 	while (!kthread_should_stop() &&
 	       !bch_move_ctxt_wait(&ctxt) &&
@@ -148,6 +150,7 @@ next:
 		cond_resched();
 	}
 
+	blk_finish_plug(&plug);
 	bch_btree_iter_unlock(&iter);
 	tier_put_device(&s);
 	bch_move_ctxt_exit(&ctxt);
@@ -2,88 +2,1095 @@
 #include <alloca.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/completion.h>
 #include <linux/fs.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
 
-int submit_bio_wait(struct bio *bio)
+/* uapi headers io_uring.h needs, that our linux/types.h doesn't pull in: */
+#include <linux/posix_types.h>
+#include <linux/stddef.h>
+#include <linux/io_uring.h>
+
+/*
+ * Bios are submitted in chains linked by bi_next: when plugged, adjacent bios
+ * are merged into one chain that's done with a single vectored read or write.
+ */
+
+static unsigned bios_nr_segs(struct bio *bio)
 {
-	struct iovec *iov;
 	struct bvec_iter iter;
 	struct bio_vec bv;
-	ssize_t ret;
-	unsigned i;
+	unsigned nr = 0;
 
-	if (bio->bi_opf & REQ_PREFLUSH) {
-		ret = fdatasync(bio->bi_bdev->bd_fd);
-		if (ret) {
-			fprintf(stderr, "fsync error: %s\n",
-				strerror(errno));
-			return -EIO;
+	for (; bio; bio = bio->bi_next)
+		bio_for_each_segment(bv, bio, iter)
+			nr++;
+
+	return nr;
+}
+
+static void bios_fill_iov(struct bio *bio, struct iovec *iov)
+{
+	struct bvec_iter iter;
+	struct bio_vec bv;
+
+	for (; bio; bio = bio->bi_next)
+		bio_for_each_segment(bv, bio, iter)
+			*iov++ = (struct iovec) {
+				.iov_base = page_address(bv.bv_page) + bv.bv_offset,
+				.iov_len = bv.bv_len,
+			};
+}
+
+static size_t bios_bytes(struct bio *bio)
+{
+	size_t bytes = 0;
+
+	for (; bio; bio = bio->bi_next)
+		bytes += bio->bi_iter.bi_size;
+
+	return bytes;
+}
+
+static void bios_endio(struct bio *bio, int error)
+{
+	struct bio *next;
+
+	for (; bio; bio = next) {
+		next = bio->bi_next;
+		bio->bi_next = NULL;
+		bio->bi_error = error;
+		bio_endio(bio);
+	}
+}
+
+/*
+ * Direct IO:
+ *
+ * With O_DIRECT, the offset, length and buffers of every IO have to be aligned
+ * to the device's logical block size. A misaligned offset or length can't be
+ * fixed up, so those IOs go to a second fd that was opened without O_DIRECT;
+ * misaligned buffers are bounced.
+ *
+ * When the device wasn't opened with FMODE_DIRECT, bd_dio_align is 1 and
+ * bd_buffered_fd is just bd_fd.
+ */
+
+/* set on devices opened while blkdev_direct_io is set, if O_DIRECT worked: */
+#define FMODE_DIRECT		((__force fmode_t)0x800)
+
+static int bios_fd(struct bio *bio, size_t bytes)
+{
+	struct block_device *bdev = bio->bi_bdev;
+
+	return IS_ALIGNED(bio->bi_iter.bi_sector << 9, bdev->bd_dio_align) &&
+		IS_ALIGNED(bytes, bdev->bd_dio_align)
+		? bdev->bd_fd
+		: bdev->bd_buffered_fd;
+}
+
+/* Returns a bounce buffer if @iov can't be used for direct IO, else NULL: */
+static void *bios_bounce_alloc(struct bio *bio, int fd,
+			       const struct iovec *iov, unsigned nr,
+			       size_t bytes)
+{
+	struct block_device *bdev = bio->bi_bdev;
+	unsigned i, align = bdev->bd_dio_align;
+	void *p, *dst;
+
+	if (fd == bdev->bd_buffered_fd)
+		return NULL;
+
+	for (i = 0; i < nr; i++)
+		if (!IS_ALIGNED((unsigned long) iov[i].iov_base, align) ||
+		    !IS_ALIGNED(iov[i].iov_len, align))
+			break;
+
+	if (i == nr)
+		return NULL;
+
+	p = aligned_alloc(align, bytes);
+	BUG_ON(!p);
+
+	if (bio_op(bio) == REQ_OP_WRITE)
+		for (dst = p, i = 0; i < nr; i++) {
+			memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+			dst += iov[i].iov_len;
 		}
+
+	return p;
+}
+
+static void bounce_copy_to_iov(const void *src, const struct iovec *iov,
+			       unsigned nr)
+{
+	unsigned i;
+
+	for (i = 0; i < nr; i++) {
+		memcpy(iov[i].iov_base, src, iov[i].iov_len);
+		src += iov[i].iov_len;
 	}
+}
 
-	i = 0;
-	bio_for_each_segment(bv, bio, iter)
-		i++;
+/*
+ * Devices opened read only are mmapped, and reads are just a copy out of the
+ * mapping - no syscall per IO. The mapping is MADV_RANDOM, since btree nodes
+ * are scattered and reading around them on a fault is mostly wasted; instead
+ * each read does an MADV_WILLNEED on exactly the range it's about to copy, and
+ * btree node readahead (see btree_iter_readahead()) covers sequential scans.
+ *
+ * A read error shows up as SIGBUS; then we jump back out and redo the read
+ * with preadv(), so that it fails the normal way:
+ */
+
+static __thread sigjmp_buf *mapped_read_jmp;
+
+static void mapped_read_sigbus(int sig, siginfo_t *info, void *uctx)
+{
+	if (mapped_read_jmp)
+		siglongjmp(*mapped_read_jmp, 1);
+
+	signal(SIGBUS, SIG_DFL);
+	raise(SIGBUS);
+}
+
+static bool bios_read_mapped(struct bio *bio)
+{
+	struct block_device *bdev = bio->bi_bdev;
+	u64 offset = bio->bi_iter.bi_sector << 9;
+	size_t bytes = bios_bytes(bio);
+	void *src = bdev->bd_map + offset;
+	sigjmp_buf jmp;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	struct bio *i;
 
+	if (!bdev->bd_map ||
+	    bio_op(bio) != REQ_OP_READ ||
+	    offset + bytes > bdev->bd_map_size)
+		return false;
+
+	if (bytes > PAGE_SIZE) {
+		void *start = (void *) round_down((unsigned long) src, PAGE_SIZE);
+
+		madvise(start, src + bytes - start, MADV_WILLNEED);
+	}
+
+	if (sigsetjmp(jmp, 0)) {
+		mapped_read_jmp = NULL;
+		return false;
+	}
+
+	mapped_read_jmp = &jmp;
+
+	for (i = bio; i; i = i->bi_next)
+		bio_for_each_segment(bv, i, iter) {
+			memcpy(page_address(bv.bv_page) + bv.bv_offset,
+			       src, bv.bv_len);
+			src += bv.bv_len;
+		}
+
+	mapped_read_jmp = NULL;
+	return true;
+}
+
+static void mapped_read_sigbus_init(void)
+{
+	struct sigaction sa = {
+		.sa_sigaction	= mapped_read_sigbus,
+		.sa_flags	= SA_SIGINFO|SA_NODEFER,
+	};
+
+	sigaction(SIGBUS, &sa, NULL);
+}
+
+static void bdev_mmap(struct block_device *bdev)
+{
+	static pthread_once_t sigbus_once = PTHREAD_ONCE_INIT;
+	size_t size = get_capacity(bdev->bd_disk) << 9;
+	void *p;
+
+	if (!size)
+		return;
+
+	p = mmap(NULL, size, PROT_READ, MAP_SHARED, bdev->bd_fd, 0);
+	if (p == MAP_FAILED)
+		return;
+
+	/* btree nodes are scattered, don't read around them on faults: */
+	madvise(p, size, MADV_RANDOM);
+
+	pthread_once(&sigbus_once, mapped_read_sigbus_init);
+
+	bdev->bd_map		= p;
+	bdev->bd_map_size	= size;
+}
+
+/* Just the read or write, flushes are handled by the caller: */
+static int bios_rw_sync(struct bio *bio)
+{
+	size_t bytes = bios_bytes(bio);
+	int fd = bios_fd(bio, bytes);
+	struct iovec *iov, bounce_iov;
+	void *bounce;
+	ssize_t ret;
+	unsigned i;
+
+	if (bios_read_mapped(bio))
+		return 0;
+
+	i = bios_nr_segs(bio);
 	iov = alloca(sizeof(*iov) * i);
+	bios_fill_iov(bio, iov);
 
-	i = 0;
-	bio_for_each_segment(bv, bio, iter)
-		iov[i++] = (struct iovec) {
-			.iov_base = page_address(bv.bv_page) + bv.bv_offset,
-			.iov_len = bv.bv_len,
+	bounce = bios_bounce_alloc(bio, fd, iov, i, bytes);
+	if (bounce)
+		bounce_iov = (struct iovec) {
+			.iov_base	= bounce,
+			.iov_len	= bytes,
 		};
 
 	switch (bio_op(bio)) {
 	case REQ_OP_READ:
-		ret = preadv(bio->bi_bdev->bd_fd, iov, i,
+		ret = preadv(fd, bounce ? &bounce_iov : iov, bounce ? 1 : i,
 			     bio->bi_iter.bi_sector << 9);
+		if (bounce && ret == bytes)
+			bounce_copy_to_iov(bounce, iov, i);
 		break;
 	case REQ_OP_WRITE:
-		ret = pwritev(bio->bi_bdev->bd_fd, iov, i,
+		ret = pwritev(fd, bounce ? &bounce_iov : iov, bounce ? 1 : i,
 			      bio->bi_iter.bi_sector << 9);
 		break;
 	default:
 		BUG();
 	}
 
-	if (ret != bio->bi_iter.bi_size) {
+	free(bounce);
+
+	if (ret != bytes) {
 		fprintf(stderr, "IO error: %li (%s)\n",
 			ret, strerror(errno));
 		return -EIO;
 	}
 
-	if (bio->bi_opf & REQ_FUA) {
-		ret = fdatasync(bio->bi_bdev->bd_fd);
-		if (ret) {
-			fprintf(stderr, "fsync error: %s\n",
+	return 0;
+}
+
+/*
+ * io_uring backend:
+ *
+ * generic_make_request() queues reads and writes on a single io_uring shared
+ * by all devices, and a reaper thread calls bio_endio() as completions come
+ * in. Flushes are fsync sqes, issued by the flush queue code below.
+ *
+ * If the kernel doesn't support io_uring we fall back to doing the IO
+ * synchronously in the submitting thread.
+ */
+
+#define URING_ENTRIES		128
+
+/* tag in the low bit of user_data for flush sqes, which point to the bdev: */
+#define URING_FLUSH_SQE		1UL
+
+static struct uring {
+	int			fd;
+	unsigned		entries;
+	unsigned		in_flight;
+
+	unsigned		*sq_head;
+	unsigned		*sq_tail;
+	unsigned		*sq_mask;
+	unsigned		*sq_array;
+	struct io_uring_sqe	*sqes;
+
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		*cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		wait;
+
+	struct task_struct	*reaper;
+} ring = {
+	.fd	= -1,
+	.lock	= PTHREAD_MUTEX_INITIALIZER,
+	.wait	= PTHREAD_COND_INITIALIZER,
+};
+
+static int io_uring_enter(unsigned to_submit, unsigned min_complete,
+			  unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, ring.fd, to_submit,
+		       min_complete, flags, NULL, 0);
+}
+
+/*
+ * Reserve space for an sqe: returns false if the IO should be done
+ * synchronously instead - either io_uring is unavailable, or we're in the
+ * reaper thread and the ring is full (waiting for space would deadlock):
+ */
+static bool uring_reserve(void)
+{
+	if (ring.fd < 0)
+		return false;
+
+	pthread_mutex_lock(&ring.lock);
+	while (ring.in_flight >= ring.entries) {
+		if (current == ring.reaper) {
+			pthread_mutex_unlock(&ring.lock);
+			return false;
+		}
+		pthread_cond_wait(&ring.wait, &ring.lock);
+	}
+	ring.in_flight++;
+	pthread_mutex_unlock(&ring.lock);
+
+	return true;
+}
+
+static void uring_release(void)
+{
+	pthread_mutex_lock(&ring.lock);
+	ring.in_flight--;
+	pthread_cond_broadcast(&ring.wait);
+	pthread_mutex_unlock(&ring.lock);
+}
+
+static void uring_submit_sqe(const struct io_uring_sqe *src)
+{
+	unsigned tail, idx;
+	int ret;
+
+	pthread_mutex_lock(&ring.lock);
+	tail	= *ring.sq_tail;
+	idx	= tail & *ring.sq_mask;
+
+	ring.sqes[idx]		= *src;
+	ring.sq_array[idx]	= idx;
+	smp_store_release(ring.sq_tail, tail + 1);
+
+	do {
+		ret = io_uring_enter(1, 0, 0);
+	} while (ret < 0 &&
+		 (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+
+	if (ret < 0) {
+		fprintf(stderr, "io_uring_enter error: %s\n",
+			strerror(errno));
+		BUG();
+	}
+	pthread_mutex_unlock(&ring.lock);
+}
+
+/*
+ * Flushes:
+ *
+ * Only one flush per device is in flight at a time. Flush requests that come
+ * in while one is running are queued up on fq->pending, and when it completes
+ * they're all satisfied by a single new flush - so under load, journal writes
+ * to the same device share their REQ_PREFLUSH and REQ_FUA flushes.
+ */
+
+struct flush_waiter {
+	struct list_head	list;
+	void			(*fn)(struct flush_waiter *, int);
+};
+
+/* Returns true if another flush needs to be issued for pending waiters: */
+static bool blk_flush_done(struct block_device *bdev, int error)
+{
+	struct blk_flush_queue *fq = &bdev->queue.fq;
+	struct flush_waiter *w, *n;
+	LIST_HEAD(done);
+	unsigned nr = 0;
+	bool issue;
+
+	if (error)
+		fprintf(stderr, "fsync error: %s\n", strerror(-error));
+
+	spin_lock(&fq->lock);
+	list_splice_init(&fq->running, &done);
+
+	list_for_each_entry(w, &done, list)
+		nr++;
+
+	fq->nr_flushes++;
+	fq->nr_flushes_saved += nr - 1;
+
+	issue = !list_empty(&fq->pending);
+	if (issue)
+		list_splice_init(&fq->pending, &fq->running);
+	else
+		fq->flush_in_flight = false;
+	spin_unlock(&fq->lock);
+
+	list_for_each_entry_safe(w, n, &done, list)
+		w->fn(w, error ? -EIO : 0);
+
+	return issue;
+}
+
+static void blk_flush_issue(struct block_device *bdev)
+{
+	do {
+		if (uring_reserve()) {
+			struct io_uring_sqe sqe = {
+				.opcode		= IORING_OP_FSYNC,
+				.fd		= bdev->bd_fd,
+				.fsync_flags	= IORING_FSYNC_DATASYNC,
+				.user_data	= (unsigned long) bdev |
+					URING_FLUSH_SQE,
+			};
+
+			uring_submit_sqe(&sqe);
+			return;
+		}
+	} while (blk_flush_done(bdev, fdatasync(bdev->bd_fd) ? -errno : 0));
+}
+
+static void blk_flush_queue_add(struct block_device *bdev,
+				struct flush_waiter *w)
+{
+	struct blk_flush_queue *fq = &bdev->queue.fq;
+	bool issue;
+
+	spin_lock(&fq->lock);
+	list_add_tail(&w->list, &fq->pending);
+
+	issue = !fq->flush_in_flight;
+	if (issue) {
+		fq->flush_in_flight = true;
+		list_splice_init(&fq->pending, &fq->running);
+	}
+	spin_unlock(&fq->lock);
+
+	if (issue)
+		blk_flush_issue(bdev);
+}
+
+struct flush_wait {
+	struct flush_waiter	w;
+	struct completion	done;
+	int			error;
+};
+
+static void flush_wait_fn(struct flush_waiter *w, int error)
+{
+	struct flush_wait *wait = container_of(w, struct flush_wait, w);
+
+	wait->error = error;
+	complete(&wait->done);
+}
+
+int blkdev_issue_flush(struct block_device *bdev, gfp_t gfp_mask,
+		       sector_t *error_sector)
+{
+	struct flush_wait wait = { .w.fn = flush_wait_fn };
+
+	/* The reaper can't wait on a flush sqe it would have to reap itself: */
+	if (current == ring.reaper)
+		return fdatasync(bdev->bd_fd) ? -EIO : 0;
+
+	init_completion(&wait.done);
+	blk_flush_queue_add(bdev, &wait.w);
+	wait_for_completion(&wait.done);
+
+	return wait.error;
+}
+
+static int submit_bios_wait(struct bio *bio)
+{
+	int ret;
+
+	if (bio->bi_opf & REQ_PREFLUSH) {
+		ret = blkdev_issue_flush(bio->bi_bdev, GFP_NOIO, NULL);
+		if (ret)
+			return ret;
+	}
+
+	ret = bios_rw_sync(bio);
+	if (ret)
+		return ret;
+
+	if (bio->bi_opf & REQ_FUA)
+		ret = blkdev_issue_flush(bio->bi_bdev, GFP_NOIO, NULL);
+
+	return ret;
+}
+
+/*
+ * Virtual devices:
+ *
+ * For benchmarking and testing, a device path can also be one of
+ *
+ *   mem:NAME,size=SIZE[,OPTS]	sparse in memory device (a memfd)
+ *   slow:PATH[,OPTS]		a real device or file
+ *
+ * with OPTS a comma separated list of
+ *
+ *   latency=USECS		added to the completion of every IO
+ *   bandwidth=BYTES		per second, IOs are queued behind each other
+ *   errors=N			fail one in N IOs, at random
+ *
+ * SIZE and BYTES take K/M/G/T suffixes. A mem device lives until the process
+ * exits, and reopening the same NAME gets the same contents - so it can be
+ * formatted and then opened with bch_fs_open().
+ *
+ * The data is still read and written with the device's fd when the IO is
+ * submitted; with latency or bandwidth limits, the completion is deferred
+ * until the IO would have finished by a per device completion thread.
+ */
+
+struct virt_dev {
+	u64			latency_ns;
+	u64			bandwidth;
+	unsigned		errors;
+
+	spinlock_t		lock;
+	/* when the IOs queued so far will have transferred: */
+	u64			busy_until;
+	struct list_head	completions;
+	struct task_struct	*thread;
+};
+
+struct virt_io {
+	struct list_head	list;
+	struct bio		*bio;
+	u64			done_at;
+	int			error;
+};
+
+static bool virt_io_fail(struct virt_dev *v)
+{
+	return v->errors && !((unsigned) get_random_int() % v->errors);
+}
+
+/* Returns when an IO of @bytes submitted now should complete: */
+static u64 virt_io_done_at(struct virt_dev *v, size_t bytes)
+{
+	u64 now = local_clock(), done_at;
+
+	spin_lock(&v->lock);
+	done_at = max(now, v->busy_until);
+	if (v->bandwidth)
+		done_at += div64_u64((u64) bytes * NSEC_PER_SEC, v->bandwidth);
+	v->busy_until = done_at;
+	spin_unlock(&v->lock);
+
+	return done_at + v->latency_ns;
+}
+
+static void sleep_until(u64 ns)
+{
+	struct timespec ts = {
+		.tv_sec		= ns / NSEC_PER_SEC,
+		.tv_nsec	= ns % NSEC_PER_SEC,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static int virt_submit_wait(struct bio *bio)
+{
+	struct virt_dev *v = bio->bi_bdev->bd_virt;
+	int ret = virt_io_fail(v) ? -EIO : submit_bios_wait(bio);
+
+	if (v->thread)
+		sleep_until(virt_io_done_at(v, bios_bytes(bio)));
+	return ret;
+}
+
+static void virt_submit(struct bio *bio)
+{
+	struct virt_dev *v = bio->bi_bdev->bd_virt;
+	struct virt_io *io;
+	int error = virt_io_fail(v) ? -EIO : submit_bios_wait(bio);
+
+	if (!v->thread) {
+		bios_endio(bio, error);
+		return;
+	}
+
+	io = kmalloc(sizeof(*io), GFP_NOIO);
+	BUG_ON(!io);
+
+	io->bio		= bio;
+	io->done_at	= virt_io_done_at(v, bios_bytes(bio));
+	io->error	= error;
+
+	/* done_at only goes forwards, so completions stay in order: */
+	spin_lock(&v->lock);
+	list_add_tail(&io->list, &v->completions);
+	spin_unlock(&v->lock);
+
+	wake_up_process(v->thread);
+}
+
+static int virt_completion_thread(void *arg)
+{
+	struct virt_dev *v = arg;
+	struct virt_io *io;
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+
+		spin_lock(&v->lock);
+		io = list_first_entry_or_null(&v->completions,
+					      struct virt_io, list);
+		spin_unlock(&v->lock);
+
+		if (!io) {
+			if (kthread_should_stop())
+				break;
+			schedule();
+			continue;
+		}
+
+		__set_current_state(TASK_RUNNING);
+		sleep_until(io->done_at);
+
+		spin_lock(&v->lock);
+		list_del(&io->list);
+		spin_unlock(&v->lock);
+
+		bios_endio(io->bio, io->error);
+		kfree(io);
+	}
+
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+int submit_bio_wait(struct bio *bio)
+{
+	bio->bi_next = NULL;
+
+	return bio->bi_bdev->bd_virt
+		? virt_submit_wait(bio)
+		: submit_bios_wait(bio);
+}
+
+/*
+ * A chain of bios being done with io_uring: REQ_PREFLUSH and REQ_FUA wait on
+ * the device's flush queue before and after the read or write sqe.
+ */
+struct uring_req {
+	struct bio		*bio;
+	size_t			bytes;
+	unsigned		nr_segs;
+	int			fd;
+	void			*bounce;
+	struct iovec		bounce_iov;
+	struct flush_waiter	flush;
+	struct iovec		iov[];
+};
+
+static void uring_req_end(struct uring_req *req, int error)
+{
+	struct bio *bio = req->bio;
+
+	free(req->bounce);
+	kfree(req);
+	bios_endio(bio, error);
+}
+
+static void uring_req_fua_done(struct flush_waiter *w, int error)
+{
+	uring_req_end(container_of(w, struct uring_req, flush), error);
+}
+
+static void uring_req_rw_done(struct uring_req *req, int error)
+{
+	if (!error && (req->bio->bi_opf & REQ_FUA)) {
+		req->flush.fn = uring_req_fua_done;
+		blk_flush_queue_add(req->bio->bi_bdev, &req->flush);
+		return;
+	}
+
+	uring_req_end(req, error);
+}
+
+static void uring_req_rw(struct uring_req *req)
+{
+	struct bio *bio = req->bio;
+	struct io_uring_sqe sqe = {
+		.opcode		= bio_op(bio) == REQ_OP_READ
+			? IORING_OP_READV
+			: IORING_OP_WRITEV,
+		.fd		= req->fd,
+		.off		= bio->bi_iter.bi_sector << 9,
+		.addr		= req->bounce
+			? (unsigned long) &req->bounce_iov
+			: (unsigned long) req->iov,
+		.len		= req->bounce ? 1 : req->nr_segs,
+		.user_data	= (unsigned long) req,
+	};
+
+	if (uring_reserve())
+		uring_submit_sqe(&sqe);
+	else
+		uring_req_rw_done(req, bios_rw_sync(bio));
+}
+
+static void uring_req_preflush_done(struct flush_waiter *w, int error)
+{
+	struct uring_req *req = container_of(w, struct uring_req, flush);
+
+	if (error)
+		uring_req_end(req, error);
+	else
+		uring_req_rw(req);
+}
+
+static void uring_cqe_done(struct io_uring_cqe *cqe)
+{
+	uring_release();
+
+	if (cqe->user_data & URING_FLUSH_SQE) {
+		struct block_device *bdev =
+			(void *) (cqe->user_data & ~URING_FLUSH_SQE);
+
+		if (blk_flush_done(bdev, cqe->res < 0 ? cqe->res : 0))
+			blk_flush_issue(bdev);
+	} else {
+		struct uring_req *req = (void *) cqe->user_data;
+
+		if (cqe->res < 0) {
+			fprintf(stderr, "IO error: %s\n", strerror(-cqe->res));
+			uring_req_end(req, -EIO);
+		} else if (cqe->res != req->bytes) {
+			/* short read or write - finish it off synchronously: */
+			uring_req_rw_done(req, bios_rw_sync(req->bio));
+		} else {
+			if (req->bounce && bio_op(req->bio) == REQ_OP_READ)
+				bounce_copy_to_iov(req->bounce, req->iov,
+						   req->nr_segs);
+			uring_req_rw_done(req, 0);
+		}
+	}
+}
+
+static int uring_reaper_thread(void *arg)
+{
+	while (1) {
+		unsigned head, tail;
+		int ret;
+
+		ret = io_uring_enter(0, 1, IORING_ENTER_GETEVENTS);
+		if (ret < 0 && errno != EINTR && errno != EAGAIN) {
+			fprintf(stderr, "io_uring_enter error: %s\n",
 				strerror(errno));
-			return -EIO;
+			BUG();
 		}
+
+		head = *ring.cq_head;
+		tail = smp_load_acquire(ring.cq_tail);
+
+		while (head != tail)
+			uring_cqe_done(&ring.cqes[head++ & *ring.cq_mask]);
+
+		smp_store_release(ring.cq_head, head);
+	}
+
+	return 0;
+}
+
+/* Returns false if the bios should be done synchronously instead: */
+static bool uring_submit(struct bio *bio)
+{
+	struct uring_req *req;
+	unsigned nr_segs;
+
+	if (ring.fd < 0 || bio->bi_bdev->bd_map)
+		return false;
+
+	switch (bio_op(bio)) {
+	case REQ_OP_READ:
+	case REQ_OP_WRITE:
+		break;
+	default:
+		return false;
 	}
 
+	nr_segs = bios_nr_segs(bio);
+
+	req = kmalloc(sizeof(*req) + sizeof(struct iovec) * nr_segs, GFP_NOIO);
+	BUG_ON(!req);
+
+	req->bio	= bio;
+	req->bytes	= bios_bytes(bio);
+	req->nr_segs	= nr_segs;
+	req->fd		= bios_fd(bio, req->bytes);
+	bios_fill_iov(bio, req->iov);
+
+	req->bounce	= bios_bounce_alloc(bio, req->fd, req->iov,
+					    nr_segs, req->bytes);
+	req->bounce_iov	= (struct iovec) {
+		.iov_base	= req->bounce,
+		.iov_len	= req->bytes,
+	};
+
+	if (bio->bi_opf & REQ_PREFLUSH) {
+		req->flush.fn = uring_req_preflush_done;
+		blk_flush_queue_add(bio->bi_bdev, &req->flush);
+	} else {
+		uring_req_rw(req);
+	}
+
+	return true;
+}
+
+static void submit_bios(struct bio *bio)
+{
+	if (bio->bi_bdev->bd_virt)
+		virt_submit(bio);
+	else if (!uring_submit(bio))
+		bios_endio(bio, submit_bios_wait(bio));
+}
+
+/* Plugging: */
+
+static bool bio_mergeable_with(struct bio *prev, struct bio *bio,
+			       unsigned nr_segs, sector_t sectors)
+{
+	return prev->bi_bdev == bio->bi_bdev &&
+		bio_op(prev) == bio_op(bio) &&
+		(bio_op(bio) == REQ_OP_READ ||
+		 bio_op(bio) == REQ_OP_WRITE) &&
+		!((prev->bi_opf|bio->bi_opf) & REQ_NOMERGE_FLAGS) &&
+		bio_end_sector(prev) == bio->bi_iter.bi_sector &&
+		nr_segs + bio_segments(bio) <= IOV_MAX &&
+		sectors + bio_sectors(bio) <=
+		queue_max_sectors(bdev_get_queue(bio->bi_bdev));
+}
+
+static int plug_bio_cmp(const void *_l, const void *_r)
+{
+	const struct bio *l = *((struct bio * const *) _l);
+	const struct bio *r = *((struct bio * const *) _r);
+
+	if (l->bi_bdev != r->bi_bdev)
+		return l->bi_bdev < r->bi_bdev ? -1 : 1;
+	if (bio_op(l) != bio_op(r))
+		return bio_op(l) < bio_op(r) ? -1 : 1;
+	if (l->bi_iter.bi_sector != r->bi_iter.bi_sector)
+		return l->bi_iter.bi_sector < r->bi_iter.bi_sector ? -1 : 1;
 	return 0;
 }
 
+/*
+ * Submit everything on the plug list: there's no ordering between bios that
+ * are in flight at the same time, so we're free to sort them by device and
+ * sector, and then each run of contiguous bios gets merged into a single
+ * chain - up to the queue's max_sectors:
+ */
+void blk_flush_plug(struct blk_plug *plug)
+{
+	while (!bio_list_empty(&plug->bios)) {
+		struct bio_list bl = plug->bios;
+		struct bio **bios, *bio, *prev = NULL, *head = NULL;
+		unsigned i, nr = plug->nr_bios, nr_segs = 0;
+		sector_t sectors = 0;
+
+		bio_list_init(&plug->bios);
+		plug->nr_bios = 0;
+
+		bios = kmalloc_array(nr, sizeof(*bios), GFP_NOIO);
+		BUG_ON(!bios);
+
+		for (i = 0; i < nr; i++)
+			bios[i] = bio_list_pop(&bl);
+
+		sort(bios, nr, sizeof(*bios), plug_bio_cmp, NULL);
+
+		for (i = 0; i < nr; i++) {
+			bio = bios[i];
+
+			if (prev &&
+			    bio_mergeable_with(prev, bio, nr_segs, sectors)) {
+				prev->bi_next = bio;
+			} else {
+				if (head)
+					submit_bios(head);
+				head = bio;
+				nr_segs = sectors = 0;
+			}
+
+			nr_segs += bio_segments(bio);
+			sectors += bio_sectors(bio);
+			prev = bio;
+		}
+
+		if (head)
+			submit_bios(head);
+
+		kfree(bios);
+	}
+}
+
+void blk_start_plug(struct blk_plug *plug)
+{
+	bio_list_init(&plug->bios);
+	plug->nr_bios = 0;
+
+	/* Nested plugs are no-ops, the outermost one gets flushed: */
+	if (!current->plug)
+		current->plug = plug;
+}
+
+void blk_finish_plug(struct blk_plug *plug)
+{
+	if (plug != current->plug)
+		return;
+
+	blk_flush_plug(plug);
+	current->plug = NULL;
+}
+
 void generic_make_request(struct bio *bio)
 {
-	bio->bi_error = submit_bio_wait(bio);
-	bio_endio(bio);
+	struct blk_plug *plug = current->plug;
+
+	bio->bi_next = NULL;
+
+	if (plug) {
+		bio_list_add(&plug->bios, bio);
+		if (++plug->nr_bios >= BLK_MAX_PLUG_BIOS)
+			blk_flush_plug(plug);
+		return;
+	}
+
+	submit_bios(bio);
+}
+
+__attribute__((constructor(103)))
+static void uring_init(void)
+{
+	struct io_uring_params p;
+	size_t sq_size, cq_size;
+	void *sq, *cq, *sqes;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+
+	fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (fd < 0)
+		return; /* no io_uring - use synchronous IO */
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		sq_size = cq_size = max(sq_size, cq_size);
+
+	sq = mmap(NULL, sq_size, PROT_READ|PROT_WRITE,
+		  MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto err;
+
+	cq = p.features & IORING_FEAT_SINGLE_MMAP
+		? sq
+		: mmap(NULL, cq_size, PROT_READ|PROT_WRITE,
+		       MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if (cq == MAP_FAILED)
+		goto err;
+
+	sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		    PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+		    fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		goto err;
+
+	ring.sq_head	= sq + p.sq_off.head;
+	ring.sq_tail	= sq + p.sq_off.tail;
+	ring.sq_mask	= sq + p.sq_off.ring_mask;
+	ring.sq_array	= sq + p.sq_off.array;
+	ring.sqes	= sqes;
+
+	ring.cq_head	= cq + p.cq_off.head;
+	ring.cq_tail	= cq + p.cq_off.tail;
+	ring.cq_mask	= cq + p.cq_off.ring_mask;
+	ring.cqes	= cq + p.cq_off.cqes;
+
+	/*
+	 * Limit sqes in flight to the sq size, so the cq (which is at least
+	 * twice as big) can never overflow:
+	 */
+	ring.entries	= p.sq_entries;
+	ring.fd		= fd;
+
+	ring.reaper = kthread_run(uring_reaper_thread, NULL, "io_uring_reaper");
+	if (IS_ERR(ring.reaper)) {
+		ring.fd = -1;
+		goto err;
+	}
+
+	return;
+err:
+	/* mappings are left alone, they go away with the process: */
+	close(fd);
 }
 
+/*
+ * Block devices get BLKDISCARD, image files get the range punched out so the
+ * underlying filesystem (or thin pool) can reuse the space. If either isn't
+ * supported we stop advertising discard support for that device:
+ */
 int blkdev_issue_discard(struct block_device *bdev,
 			 sector_t sector, sector_t nr_sects,
 			 gfp_t gfp_mask, unsigned long flags)
 {
-	return 0;
+	struct request_queue *q = bdev_get_queue(bdev);
+	struct stat statbuf;
+	int ret;
+
+	if (!blk_queue_discard(q))
+		return -EOPNOTSUPP;
+
+	ret = fstat(bdev->bd_fd, &statbuf);
+	BUG_ON(ret);
+
+	if (S_ISBLK(statbuf.st_mode)) {
+		u64 range[2] = { sector << 9, nr_sects << 9 };
+
+		ret = ioctl(bdev->bd_fd, BLKDISCARD, range);
+	} else {
+		ret = fallocate(bdev->bd_fd,
+				FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+				sector << 9, nr_sects << 9);
+	}
+
+	if (ret) {
+		ret = -errno;
+
+		if (ret == -EOPNOTSUPP || ret == -ENOTTY)
+			clear_bit(QUEUE_FLAG_DISCARD, &q->queue_flags);
+		else
+			fprintf(stderr, "discard error: %s\n", strerror(-ret));
+	}
+
+	return ret;
 }
 
 unsigned bdev_logical_block_size(struct block_device *bdev)
@@ -126,16 +1133,79 @@ sector_t get_capacity(struct gendisk *disk)
 
 void blkdev_put(struct block_device *bdev, fmode_t mode)
 {
+	struct virt_dev *v = bdev->bd_virt;
+
+	if (v) {
+		if (v->thread)
+			kthread_stop(v->thread);
+		kfree(v);
+	}
+
+	if (bdev->bd_map)
+		munmap(bdev->bd_map, bdev->bd_map_size);
+
 	fdatasync(bdev->bd_fd);
+	if (bdev->bd_buffered_fd != bdev->bd_fd)
+		close(bdev->bd_buffered_fd);
 	close(bdev->bd_fd);
 	free(bdev);
 }
 
-struct block_device *blkdev_get_by_path(const char *path, fmode_t mode,
-					void *holder)
+unsigned blkdev_max_sectors = BLK_DEF_MAX_SECTORS;
+bool blkdev_direct_io;
+
+static struct block_device *bdev_alloc(const char *path, int fd,
+				       int buffered_fd, unsigned dio_align,
+				       fmode_t mode, void *holder)
 {
 	struct block_device *bdev;
-	int fd, flags = O_DIRECT;
+
+	bdev = malloc(sizeof(*bdev));
+	memset(bdev, 0, sizeof(*bdev));
+
+	strncpy(bdev->name, path, sizeof(bdev->name));
+	bdev->name[sizeof(bdev->name) - 1] = '\0';
+
+	bdev->bd_fd		= fd;
+	bdev->bd_buffered_fd	= buffered_fd;
+	bdev->bd_dio_align	= dio_align;
+	bdev->bd_holder		= holder;
+	bdev->bd_disk		= &bdev->__bd_disk;
+
+	blk_queue_max_hw_sectors(&bdev->queue, blkdev_max_sectors);
+
+	spin_lock_init(&bdev->queue.fq.lock);
+	INIT_LIST_HEAD(&bdev->queue.fq.running);
+	INIT_LIST_HEAD(&bdev->queue.fq.pending);
+
+	if (mode & FMODE_WRITE)
+		set_bit(QUEUE_FLAG_DISCARD, &bdev->queue.queue_flags);
+
+	return bdev;
+}
+
+static unsigned dio_align(int fd)
+{
+	struct stat statbuf;
+	int ret, blksize;
+
+	ret = fstat(fd, &statbuf);
+	BUG_ON(ret);
+
+	if (!S_ISBLK(statbuf.st_mode))
+		return statbuf.st_blksize;
+
+	ret = ioctl(fd, BLKSSZGET, &blksize);
+	BUG_ON(ret);
+
+	return blksize;
+}
+
+static struct block_device *__blkdev_get_by_path(const char *path,
+						 fmode_t mode, void *holder)
+{
+	struct block_device *bdev;
+	int fd, buffered_fd, flags = 0;
 
 	if ((mode & (FMODE_READ|FMODE_WRITE)) == (FMODE_READ|FMODE_WRITE))
 		flags = O_RDWR;
@@ -147,23 +1217,193 @@ struct block_device *blkdev_get_by_path(const char *path, fmode_t mode,
 	if (mode & FMODE_EXCL)
 		flags |= O_EXCL;
 
-	fd = open(path, flags);
+	if (blkdev_direct_io)
+		mode |= FMODE_DIRECT;
+
+	fd = open(path, mode & FMODE_DIRECT ? flags|O_DIRECT : flags);
+	if (fd < 0 && errno == EINVAL && (mode & FMODE_DIRECT)) {
+		fprintf(stderr, "%s: direct IO not supported, using buffered IO\n",
+			path);
+		mode &= ~FMODE_DIRECT;
+		fd = open(path, flags);
+	}
+
 	if (fd < 0)
 		return ERR_PTR(-errno);
 
-	bdev = malloc(sizeof(*bdev));
-	memset(bdev, 0, sizeof(*bdev));
+	buffered_fd = fd;
 
-	strncpy(bdev->name, path, sizeof(bdev->name));
-	bdev->name[sizeof(bdev->name) - 1] = '\0';
+	if (mode & FMODE_DIRECT) {
+		/* no O_EXCL, we already hold the device: */
+		buffered_fd = open(path, flags & ~O_EXCL);
+		if (buffered_fd < 0) {
+			int ret = -errno;
 
-	bdev->bd_fd	= fd;
-	bdev->bd_holder = holder;
-	bdev->bd_disk	= &bdev->__bd_disk;
+			close(fd);
+			return ERR_PTR(ret);
+		}
+	}
+
+	bdev = bdev_alloc(path, fd, buffered_fd,
+			  mode & FMODE_DIRECT ? dio_align(fd) : 1,
+			  mode, holder);
+
+	if (!(mode & (FMODE_WRITE|FMODE_DIRECT)))
+		bdev_mmap(bdev);
 
 	return bdev;
 }
 
+/* Virtual devices, see above: */
+
+struct mem_arena {
+	struct list_head	list;
+	char			*name;
+	int			fd;
+};
+
+static LIST_HEAD(mem_arenas);
+static pthread_mutex_t mem_arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Returns a new fd for arena @name - if it doesn't exist, @size is required: */
+static int mem_arena_open(const char *name, u64 size)
+{
+	struct mem_arena *a;
+	int fd;
+
+	pthread_mutex_lock(&mem_arenas_lock);
+	list_for_each_entry(a, &mem_arenas, list)
+		if (!strcmp(a->name, name))
+			goto found;
+
+	fd = -EINVAL;
+	if (!size)
+		goto out;
+
+	fd = memfd_create(name, MFD_CLOEXEC);
+	if (fd < 0) {
+		fd = -errno;
+		goto out;
+	}
+
+	if (ftruncate(fd, size)) {
+		int ret = -errno;
+
+		close(fd);
+		fd = ret;
+		goto out;
+	}
+
+	a = kmalloc(sizeof(*a), GFP_KERNEL);
+	BUG_ON(!a);
+
+	a->name	= strdup(name);
+	a->fd	= fd;
+	list_add(&a->list, &mem_arenas);
+found:
+	fd = dup(a->fd);
+	if (fd < 0)
+		fd = -errno;
+out:
+	pthread_mutex_unlock(&mem_arenas_lock);
+	return fd;
+}
+
+static int virt_dev_parse_opts(struct virt_dev *v, u64 *size, char *opts)
+{
+	char *opt, *val, *end;
+
+	while ((opt = strsep(&opts, ","))) {
+		if (!*opt)
+			continue;
+
+		val = strchr(opt, '=');
+		if (!val)
+			return -EINVAL;
+		*val++ = '\0';
+
+		if (!strcmp(opt, "size") && size)
+			*size = memparse(val, &end);
+		else if (!strcmp(opt, "latency"))
+			v->latency_ns = simple_strtoull(val, &end, 10) *
+				NSEC_PER_USEC;
+		else if (!strcmp(opt, "bandwidth"))
+			v->bandwidth = memparse(val, &end);
+		else if (!strcmp(opt, "errors"))
+			v->errors = simple_strtoul(val, &end, 10);
+		else
+			return -EINVAL;
+
+		if (end == val || *end)
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+static struct block_device *virt_dev_open(const char *path, fmode_t mode,
+					  void *holder)
+{
+	struct block_device *bdev;
+	struct virt_dev *v;
+	bool mem = !strncmp(path, "mem:", 4);
+	char *buf = strdup(path), *name, *opts;
+	u64 size = 0;
+	int ret, fd;
+
+	name = buf + (mem ? 4 : 5);
+	opts = strchr(name, ',');
+	if (opts)
+		*opts++ = '\0';
+
+	v = kzalloc(sizeof(*v), GFP_KERNEL);
+	BUG_ON(!v);
+
+	spin_lock_init(&v->lock);
+	INIT_LIST_HEAD(&v->completions);
+
+	ret = virt_dev_parse_opts(v, mem ? &size : NULL, opts);
+	if (ret) {
+		bdev = ERR_PTR(ret);
+		goto err;
+	}
+
+	if (mem) {
+		fd = mem_arena_open(name, size);
+		bdev = fd >= 0
+			? bdev_alloc(path, fd, fd, 1, mode, holder)
+			: ERR_PTR(fd);
+	} else {
+		bdev = __blkdev_get_by_path(name, mode, holder);
+	}
+
+	if (IS_ERR(bdev))
+		goto err;
+
+	if (v->latency_ns || v->bandwidth) {
+		v->thread = kthread_run(virt_completion_thread, v, "virt_io");
+		BUG_ON(IS_ERR(v->thread));
+	}
+
+	bdev->bd_virt = v;
+	free(buf);
+	return bdev;
+err:
+	kfree(v);
+	free(buf);
+	return bdev;
+}
+
+struct block_device *blkdev_get_by_path(const char *path, fmode_t mode,
+					void *holder)
+{
+	if (!strncmp(path, "mem:", 4) ||
+	    !strncmp(path, "slow:", 5))
+		return virt_dev_open(path, mode, holder);
+
+	return __blkdev_get_by_path(path, mode, holder);
+}
+
 void bdput(struct block_device *bdev)
 {
 	BUG();
@@ -19,6 +19,7 @@
 #include <crypto/algapi.h>
 #include <crypto/chacha20.h>
 
+#include <sodium/core.h>
 #include <sodium/crypto_stream_chacha20.h>
 
 struct chacha20_ctx {
@@ -95,5 +96,12 @@ static struct crypto_alg alg = {
 __attribute__((constructor(110)))
 static int chacha20_generic_mod_init(void)
 {
+	/*
+	 * libsodium only switches to its SSSE3/AVX2 implementations once
+	 * sodium_init() has checked what the cpu supports:
+	 */
+	if (sodium_init() < 0)
+		return -ENOMEM;
+
 	return crypto_register_alg(&alg);
 }
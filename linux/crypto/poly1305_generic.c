@@ -21,6 +21,8 @@
 #include <crypto/internal/hash.h>
 #include <crypto/poly1305.h>
 
+#include <sodium/core.h>
+
 struct poly1305_desc_ctx {
 	bool					key_done;
 	crypto_onetimeauth_poly1305_state	s;
@@ -72,5 +74,9 @@ static struct shash_alg poly1305_alg = {
 __attribute__((constructor(110)))
 static int poly1305_mod_init(void)
 {
+	/* picks libsodium's SSE2/AVX2 poly1305, if the cpu has them: */
+	if (sodium_init() < 0)
+		return -ENOMEM;
+
 	return crypto_register_shash(&poly1305_alg);
 }
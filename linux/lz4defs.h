@@ -127,7 +127,7 @@ struct lz4_hashtable {
 #define HTYPE const u8*
 #endif
 
-#ifdef __BIG_ENDIAN
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
 #define LZ4_NBCOMMONBYTES(val) (__builtin_clzl(val) >> 3)
 #else
 #define LZ4_NBCOMMONBYTES(val) (__builtin_ctzl(val) >> 3)
@@ -0,0 +1,216 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/atomic.h>
+#include <linux/bug.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+
+/*
+ * Page allocations - btree node buffers, bounce buffers, bio pages - are big
+ * enough that malloc() hands most of them straight back to the kernel when
+ * they're freed, and faults them back in on the next allocation. So we keep
+ * freed pages around instead, per order:
+ *
+ * Each thread has a small magazine of free pages per order that it allocates
+ * from and frees to without taking any locks; when a magazine is empty or
+ * full, half a magazine's worth is moved to or from a global depot. The depot
+ * is capped at PAGE_POOL_MAX_BYTES, past that pages go back to malloc.
+ *
+ * Free pages are chained together through their first word.
+ */
+
+#define PAGE_POOL_MAX_BYTES	(64UL << 20)
+#define MAGAZINE_BYTES		(512UL << 10)
+#define MAGAZINE_MAX		64
+
+struct free_page {
+	struct free_page	*next;
+};
+
+struct page_magazine {
+	struct free_page	*pages;
+	unsigned		nr;
+};
+
+struct page_depot {
+	pthread_mutex_t		lock;
+	struct free_page	*pages;
+	unsigned		nr;
+};
+
+static __thread struct page_magazine magazines[PAGE_POOL_ORDERS];
+static struct page_depot depots[PAGE_POOL_ORDERS] = {
+	[0 ... PAGE_POOL_ORDERS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+static atomic_long_t depot_bytes;
+
+static pthread_once_t magazine_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t magazine_key;
+
+/*
+ * Statically allocated and indexed by percpu shard, so that nothing here
+ * needs initializing before the first allocation - these are only statistics,
+ * so races between threads sharing a shard don't matter:
+ */
+struct page_pool_counters {
+	u64			allocs;
+	u64			frees;
+	u64			hits;
+} ____cacheline_aligned;
+
+static struct page_pool_counters counters[NR_CPUS];
+
+#define page_pool_count(_name)	counters[raw_smp_processor_id()]._name++
+
+static inline unsigned magazine_max(unsigned order)
+{
+	return clamp_t(unsigned long, MAGAZINE_BYTES >> (PAGE_SHIFT + order),
+		       1, MAGAZINE_MAX);
+}
+
+static void *page_pop(struct free_page **pages)
+{
+	struct free_page *p = *pages;
+
+	*pages = p->next;
+	return p;
+}
+
+static void page_push(struct free_page **pages, void *page)
+{
+	struct free_page *p = page;
+
+	p->next = *pages;
+	*pages = p;
+}
+
+static void magazine_refill(struct page_magazine *m, unsigned order)
+{
+	struct page_depot *d = &depots[order];
+	unsigned nr = max(magazine_max(order) / 2, 1U);
+
+	pthread_mutex_lock(&d->lock);
+	while (d->nr && m->nr < nr) {
+		page_push(&m->pages, page_pop(&d->pages));
+		d->nr--;
+		m->nr++;
+		atomic_long_sub(PAGE_SIZE << order, &depot_bytes);
+	}
+	pthread_mutex_unlock(&d->lock);
+}
+
+static void magazine_drain(struct page_magazine *m, unsigned order,
+			   unsigned nr)
+{
+	struct page_depot *d = &depots[order];
+
+	pthread_mutex_lock(&d->lock);
+	while (m->nr > nr) {
+		void *p = page_pop(&m->pages);
+
+		m->nr--;
+
+		if (atomic_long_read(&depot_bytes) + (PAGE_SIZE << order) >
+		    PAGE_POOL_MAX_BYTES) {
+			free(p);
+			continue;
+		}
+
+		page_push(&d->pages, p);
+		d->nr++;
+		atomic_long_add(PAGE_SIZE << order, &depot_bytes);
+	}
+	pthread_mutex_unlock(&d->lock);
+}
+
+/* Exiting threads give their magazines back to the depot: */
+static void magazines_exit(void *p)
+{
+	unsigned order;
+
+	for (order = 0; order < PAGE_POOL_ORDERS; order++)
+		magazine_drain(&magazines[order], order, 0);
+}
+
+static void magazine_key_init(void)
+{
+	if (pthread_key_create(&magazine_key, magazines_exit))
+		BUG();
+}
+
+struct page *alloc_pages(gfp_t flags, unsigned int order)
+{
+	size_t size = PAGE_SIZE << order;
+	void *p = NULL;
+
+	page_pool_count(allocs);
+
+	if (order < PAGE_POOL_ORDERS) {
+		struct page_magazine *m = &magazines[order];
+
+		if (!m->nr)
+			magazine_refill(m, order);
+
+		if (m->nr) {
+			p = page_pop(&m->pages);
+			m->nr--;
+			page_pool_count(hits);
+		}
+	}
+
+	if (!p)
+		p = aligned_alloc(PAGE_SIZE, size);
+
+	if (p && (flags & __GFP_ZERO))
+		memset(p, 0, size);
+
+	return p;
+}
+
+void __free_pages(struct page *page, unsigned int order)
+{
+	struct page_magazine *m;
+
+	if (!page)
+		return;
+
+	page_pool_count(frees);
+
+	if (order >= PAGE_POOL_ORDERS) {
+		free(page);
+		return;
+	}
+
+	m = &magazines[order];
+
+	/* Only set the key once this thread has something to give back: */
+	if (!m->pages) {
+		pthread_once(&magazine_key_once, magazine_key_init);
+		pthread_setspecific(magazine_key, magazines);
+	}
+
+	page_push(&m->pages, page);
+	m->nr++;
+
+	if (m->nr > magazine_max(order))
+		magazine_drain(m, order, magazine_max(order) / 2);
+}
+
+void page_pool_stats(struct page_pool_stats *stats)
+{
+	int cpu;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for_each_possible_cpu(cpu) {
+		struct page_pool_counters *c = &counters[cpu];
+
+		stats->allocs	+= c->allocs;
+		stats->frees	+= c->frees;
+		stats->hits	+= c->hits;
+	}
+
+	stats->depot_bytes = atomic_long_read(&depot_bytes);
+}
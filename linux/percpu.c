@@ -0,0 +1,160 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <linux/bitmap.h>
+#include <linux/bitops.h>
+#include <linux/bug.h>
+#include <linux/percpu.h>
+
+/*
+ * Percpu shards are handed out to threads as they need them and freed when a
+ * thread exits, so that normally a shard only ever has one thread writing to
+ * it.
+ *
+ * The number of shards is fixed at startup, to the number of configured cpus:
+ * if more threads than that are using percpu data at once, the extras have to
+ * share shards. The this_cpu_*() ops are atomic, so they're still correct
+ * then; see percpu.h for updates done through this_cpu_ptr().
+ */
+
+__thread int __pcpu_cpu = -1;
+unsigned nr_cpu_ids = 1;
+unsigned nr_online_cpus = 1;
+
+static pthread_mutex_t	pcpu_lock = PTHREAD_MUTEX_INITIALIZER;
+static DECLARE_BITMAP(pcpu_cpus_used, NR_CPUS);
+static unsigned		pcpu_overflow;
+static pthread_key_t	pcpu_key;
+
+int __pcpu_cpu_get(void)
+{
+	unsigned cpu;
+
+	pthread_mutex_lock(&pcpu_lock);
+	cpu = find_first_zero_bit(pcpu_cpus_used, nr_cpu_ids);
+	if (cpu < nr_cpu_ids) {
+		__set_bit(cpu, pcpu_cpus_used);
+		/* +1, so that the destructor runs for cpu 0: */
+		pthread_setspecific(pcpu_key, (void *) (unsigned long) (cpu + 1));
+	} else {
+		cpu = pcpu_overflow++ % nr_cpu_ids;
+	}
+	pthread_mutex_unlock(&pcpu_lock);
+
+	__pcpu_cpu = cpu;
+	return cpu;
+}
+
+static void pcpu_cpu_put(void *p)
+{
+	unsigned cpu = (unsigned long) p - 1;
+
+	pthread_mutex_lock(&pcpu_lock);
+	clear_bit(cpu, pcpu_cpus_used);
+	pthread_mutex_unlock(&pcpu_lock);
+}
+
+/*
+ * Allocations:
+ *
+ * As in the kernel, all percpu allocations come out of one area of
+ * nr_cpu_ids units, PCPU_UNIT_SIZE apart. An allocation is a range of blocks
+ * at the same offset in every unit; the area is reserved up front, and only
+ * the pages that are used get faulted in.
+ */
+
+#define PCPU_BLOCK_SIZE		L1_CACHE_BYTES
+#define PCPU_NR_BLOCKS		(PCPU_UNIT_SIZE / PCPU_BLOCK_SIZE)
+
+static void			*pcpu_base;
+static DECLARE_BITMAP(pcpu_blocks_used, PCPU_NR_BLOCKS);
+/* size in blocks of the allocation starting at each block, for free_percpu() */
+static u16			pcpu_alloc_blocks[PCPU_NR_BLOCKS];
+
+static long pcpu_find_area(unsigned nr)
+{
+	unsigned long start = 0, end;
+
+	while (1) {
+		start = find_next_zero_bit(pcpu_blocks_used,
+					   PCPU_NR_BLOCKS, start);
+		if (start + nr > PCPU_NR_BLOCKS)
+			return -1;
+
+		end = find_next_bit(pcpu_blocks_used, start + nr, start);
+		if (end == start + nr)
+			return start;
+
+		start = end;
+	}
+}
+
+void __percpu *__alloc_percpu(size_t size, size_t align)
+{
+	unsigned i, nr = DIV_ROUND_UP(size, PCPU_BLOCK_SIZE);
+	long start;
+	void *p;
+	int cpu;
+
+	if (WARN_ON(align > PCPU_BLOCK_SIZE))
+		return NULL;
+
+	pthread_mutex_lock(&pcpu_lock);
+	start = pcpu_find_area(nr);
+	if (start < 0) {
+		pthread_mutex_unlock(&pcpu_lock);
+		return NULL;
+	}
+
+	for (i = start; i < start + nr; i++)
+		__set_bit(i, pcpu_blocks_used);
+	pcpu_alloc_blocks[start] = nr;
+	pthread_mutex_unlock(&pcpu_lock);
+
+	p = pcpu_base + start * PCPU_BLOCK_SIZE;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(p, cpu), 0, size);
+	return p;
+}
+
+void free_percpu(void __percpu *ptr)
+{
+	unsigned i, start, nr;
+
+	if (!ptr)
+		return;
+
+	start = (ptr - pcpu_base) / PCPU_BLOCK_SIZE;
+
+	pthread_mutex_lock(&pcpu_lock);
+	nr = pcpu_alloc_blocks[start];
+	BUG_ON(!nr);
+	pcpu_alloc_blocks[start] = 0;
+
+	for (i = start; i < start + nr; i++)
+		clear_bit(i, pcpu_blocks_used);
+	pthread_mutex_unlock(&pcpu_lock);
+}
+
+__attribute__((constructor(101)))
+static void percpu_init(void)
+{
+	long nr = sysconf(_SC_NPROCESSORS_CONF);
+
+	nr_cpu_ids = clamp_t(long, nr, 1, NR_CPUS);
+	nr_online_cpus = clamp_t(long, sysconf(_SC_NPROCESSORS_ONLN),
+				 1, nr_cpu_ids);
+
+	pcpu_base = mmap(NULL, (size_t) nr_cpu_ids * PCPU_UNIT_SIZE,
+			 PROT_READ|PROT_WRITE,
+			 MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (pcpu_base == MAP_FAILED)
+		BUG();
+
+	if (pthread_key_create(&pcpu_key, pcpu_cpu_put))
+		BUG();
+}
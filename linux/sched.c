@@ -1,6 +1,7 @@
 
 #include <string.h>
 
+#include <linux/bio.h>
 #include <linux/math64.h>
 #include <linux/printk.h>
 #include <linux/rcupdate.h>
@@ -32,6 +33,10 @@ int wake_up_process(struct task_struct *p)
 
 void schedule(void)
 {
+	/* Don't sleep on IO that's sitting on our own plug list: */
+	if (current->plug)
+		blk_flush_plug(current->plug);
+
 	rcu_quiescent_state();
 
 	pthread_mutex_lock(&current->lock);
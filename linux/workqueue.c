@@ -1,21 +1,45 @@
 #include <pthread.h>
+#include <unistd.h>
 
 #include <linux/kthread.h>
 #include <linux/slab.h>
 #include <linux/workqueue.h>
 
-static pthread_mutex_t	wq_lock = PTHREAD_MUTEX_INITIALIZER;
-static LIST_HEAD(wq_list);
-
-struct workqueue_struct {
+/*
+ * Each workqueue has its own lock, and a pool of worker threads: workers are
+ * started as work is queued, up to max_active (or the number of cpus, if
+ * that's smaller) - they're never stopped until the workqueue is destroyed.
+ *
+ * Like in the kernel, a work item never runs on two workers at once: if it's
+ * queued again while it's running, other workers skip over it and the worker
+ * that's running it picks it up when it finishes.
+ *
+ * As in the kernel, the workqueue a work item was last queued on is stashed in
+ * work->data, above the pending bit - it's what cancelling and flushing look
+ * at, and it's only changed with the pending bit and that workqueue's lock
+ * held.
+ */
+
+struct worker {
 	struct list_head	list;
-
+	struct workqueue_struct	*wq;
+	struct task_struct	*task;
 	struct work_struct	*current_work;
+};
+
+struct workqueue_struct {
+	pthread_mutex_t		lock;
 	struct list_head	pending_work;
 
+	pthread_cond_t		more_work;
 	pthread_cond_t		work_finished;
 
-	struct task_struct	*worker;
+	struct list_head	workers;
+	unsigned		nr_workers;
+	unsigned		nr_idle;
+	unsigned		max_workers;
+	bool			stopping;
+
 	char			name[24];
 };
 
@@ -33,24 +57,81 @@ static bool set_work_pending(struct work_struct *work)
 	return !test_and_set_bit(WORK_PENDING_BIT, work_data_bits(work));
 }
 
+static void set_work_wq(struct work_struct *work, struct workqueue_struct *wq)
+{
+	atomic_long_set(&work->data, (unsigned long) wq|(1UL << WORK_PENDING_BIT));
+}
+
+static struct workqueue_struct *get_work_wq(struct work_struct *work)
+{
+	return (void *) (atomic_long_read(&work->data) &
+			 ~(1UL << WORK_PENDING_BIT));
+}
+
+static bool work_running(struct workqueue_struct *wq,
+			 struct work_struct *work)
+{
+	struct worker *worker;
+
+	list_for_each_entry(worker, &wq->workers, list)
+		if (worker->current_work == work)
+			return true;
+
+	return false;
+}
+
+static int worker_thread(void *arg);
+
+static void start_worker(struct workqueue_struct *wq)
+{
+	struct worker *worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+
+	BUG_ON(!worker);
+
+	worker->wq = wq;
+	worker->task = kthread_create(worker_thread, worker, "%s/%u",
+				      wq->name, wq->nr_workers);
+	if (IS_ERR(worker->task)) {
+		/* we still have at least one worker: */
+		BUG_ON(!wq->nr_workers);
+		kfree(worker);
+		return;
+	}
+
+	/*
+	 * Workers exit as soon as the workqueue is stopping, possibly before
+	 * kthread_stop() is called - so pin the task_struct:
+	 */
+	get_task_struct(worker->task);
+	wake_up_process(worker->task);
+
+	list_add_tail(&worker->list, &wq->workers);
+	wq->nr_workers++;
+}
+
 static void __queue_work(struct workqueue_struct *wq,
 			 struct work_struct *work)
 {
+	pthread_mutex_lock(&wq->lock);
 	BUG_ON(!test_bit(WORK_PENDING_BIT, work_data_bits(work)));
 	BUG_ON(!list_empty(&work->entry));
 
+	set_work_wq(work, wq);
 	list_add_tail(&work->entry, &wq->pending_work);
-	wake_up_process(wq->worker);
+
+	if (wq->nr_idle)
+		pthread_cond_signal(&wq->more_work);
+	else if (wq->nr_workers < wq->max_workers)
+		start_worker(wq);
+	pthread_mutex_unlock(&wq->lock);
 }
 
 bool queue_work(struct workqueue_struct *wq, struct work_struct *work)
 {
 	bool ret;
 
-	pthread_mutex_lock(&wq_lock);
 	if ((ret = set_work_pending(work)))
 		__queue_work(wq, work);
-	pthread_mutex_unlock(&wq_lock);
 
 	return ret;
 }
@@ -59,9 +140,7 @@ void delayed_work_timer_fn(unsigned long __data)
 {
 	struct delayed_work *dwork = (struct delayed_work *) __data;
 
-	pthread_mutex_lock(&wq_lock);
 	__queue_work(dwork->wq, &dwork->work);
-	pthread_mutex_unlock(&wq_lock);
 }
 
 static void __queue_delayed_work(struct workqueue_struct *wq,
@@ -92,16 +171,19 @@ bool queue_delayed_work(struct workqueue_struct *wq,
 	struct work_struct *work = &dwork->work;
 	bool ret;
 
-	pthread_mutex_lock(&wq_lock);
 	if ((ret = set_work_pending(work)))
 		__queue_delayed_work(wq, dwork, delay);
-	pthread_mutex_unlock(&wq_lock);
 
 	return ret;
 }
 
+/*
+ * Take ownership of the pending bit: returns true if the work was pending (and
+ * is now off its workqueue or timer), false if it wasn't:
+ */
 static bool grab_pending(struct work_struct *work, bool is_dwork)
 {
+	struct workqueue_struct *wq;
 retry:
 	if (set_work_pending(work)) {
 		BUG_ON(!list_empty(&work->entry));
@@ -117,30 +199,42 @@ retry:
 		}
 	}
 
-	if (!list_empty(&work->entry)) {
-		list_del_init(&work->entry);
-		return true;
+	wq = get_work_wq(work);
+	if (wq) {
+		pthread_mutex_lock(&wq->lock);
+		if (get_work_wq(work) == wq && !list_empty(&work->entry)) {
+			list_del_init(&work->entry);
+			pthread_mutex_unlock(&wq->lock);
+			return true;
+		}
+		pthread_mutex_unlock(&wq->lock);
 	}
 
-	BUG_ON(!is_dwork);
-
-	pthread_mutex_unlock(&wq_lock);
-	flush_timers();
-	pthread_mutex_lock(&wq_lock);
+	/*
+	 * Pending, but not yet on a workqueue - either the timer is firing, or
+	 * someone's in the middle of queueing it:
+	 */
+	if (is_dwork)
+		flush_timers();
+	else
+		sched_yield();
 	goto retry;
 }
 
 static bool __flush_work(struct work_struct *work)
 {
-	struct workqueue_struct *wq;
+	struct workqueue_struct *wq = get_work_wq(work);
 	bool ret = false;
-retry:
-	list_for_each_entry(wq, &wq_list, list)
-		if (wq->current_work == work) {
-			pthread_cond_wait(&wq->work_finished, &wq_lock);
-			ret = true;
-			goto retry;
-		}
+
+	if (!wq)
+		return false;
+
+	pthread_mutex_lock(&wq->lock);
+	while (work_running(wq, work)) {
+		pthread_cond_wait(&wq->work_finished, &wq->lock);
+		ret = true;
+	}
+	pthread_mutex_unlock(&wq->lock);
 
 	return ret;
 }
@@ -149,12 +243,10 @@ bool cancel_work_sync(struct work_struct *work)
 {
 	bool ret;
 
-	pthread_mutex_lock(&wq_lock);
 	ret = grab_pending(work, false);
 
 	__flush_work(work);
 	clear_work_pending(work);
-	pthread_mutex_unlock(&wq_lock);
 
 	return ret;
 }
@@ -166,11 +258,9 @@ bool mod_delayed_work(struct workqueue_struct *wq,
 	struct work_struct *work = &dwork->work;
 	bool ret;
 
-	pthread_mutex_lock(&wq_lock);
 	ret = grab_pending(work, true);
 
 	__queue_delayed_work(wq, dwork, delay);
-	pthread_mutex_unlock(&wq_lock);
 
 	return ret;
 }
@@ -180,11 +270,9 @@ bool cancel_delayed_work(struct delayed_work *dwork)
 	struct work_struct *work = &dwork->work;
 	bool ret;
 
-	pthread_mutex_lock(&wq_lock);
 	ret = grab_pending(work, true);
 
 	clear_work_pending(&dwork->work);
-	pthread_mutex_unlock(&wq_lock);
 
 	return ret;
 }
@@ -194,62 +282,77 @@ bool cancel_delayed_work_sync(struct delayed_work *dwork)
 	struct work_struct *work = &dwork->work;
 	bool ret;
 
-	pthread_mutex_lock(&wq_lock);
 	ret = grab_pending(work, true);
 
 	__flush_work(work);
 	clear_work_pending(work);
-	pthread_mutex_unlock(&wq_lock);
 
 	return ret;
 }
 
+/* The first pending work item that isn't already running on another worker: */
+static struct work_struct *next_work(struct workqueue_struct *wq)
+{
+	struct work_struct *work;
+
+	list_for_each_entry(work, &wq->pending_work, entry)
+		if (!work_running(wq, work))
+			return work;
+
+	return NULL;
+}
+
 static int worker_thread(void *arg)
 {
-	struct workqueue_struct *wq = arg;
+	struct worker *worker = arg;
+	struct workqueue_struct *wq = worker->wq;
 	struct work_struct *work;
 
-	pthread_mutex_lock(&wq_lock);
+	pthread_mutex_lock(&wq->lock);
 	while (1) {
-		__set_current_state(TASK_INTERRUPTIBLE);
-		work = list_first_entry_or_null(&wq->pending_work,
-				struct work_struct, entry);
-		wq->current_work = work;
-
-		if (kthread_should_stop()) {
-			BUG_ON(wq->current_work);
-			break;
-		}
+		work = next_work(wq);
 
 		if (!work) {
-			pthread_mutex_unlock(&wq_lock);
-			schedule();
-			pthread_mutex_lock(&wq_lock);
+			if (wq->stopping)
+				break;
+
+			wq->nr_idle++;
+			pthread_cond_wait(&wq->more_work, &wq->lock);
+			wq->nr_idle--;
 			continue;
 		}
 
 		BUG_ON(!test_bit(WORK_PENDING_BIT, work_data_bits(work)));
 		list_del_init(&work->entry);
 		clear_work_pending(work);
+		worker->current_work = work;
 
-		pthread_mutex_unlock(&wq_lock);
+		pthread_mutex_unlock(&wq->lock);
 		work->func(work);
-		pthread_mutex_lock(&wq_lock);
+		pthread_mutex_lock(&wq->lock);
 
+		worker->current_work = NULL;
 		pthread_cond_broadcast(&wq->work_finished);
 	}
-	pthread_mutex_unlock(&wq_lock);
+	pthread_mutex_unlock(&wq->lock);
 
 	return 0;
 }
 
 void destroy_workqueue(struct workqueue_struct *wq)
 {
-	kthread_stop(wq->worker);
+	struct worker *worker, *n;
+
+	pthread_mutex_lock(&wq->lock);
+	wq->stopping = true;
+	pthread_cond_broadcast(&wq->more_work);
+	pthread_mutex_unlock(&wq->lock);
 
-	pthread_mutex_lock(&wq_lock);
-	list_del(&wq->list);
-	pthread_mutex_unlock(&wq_lock);
+	list_for_each_entry_safe(worker, n, &wq->workers, list) {
+		kthread_stop(worker->task);
+		put_task_struct(worker->task);
+		kfree(worker);
+	}
 
 	kfree(wq);
 }
@@ -261,30 +364,40 @@ struct workqueue_struct *alloc_workqueue(const char *fmt,
 {
 	va_list args;
 	struct workqueue_struct *wq;
+	long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
 
 	wq = kzalloc(sizeof(*wq), GFP_KERNEL);
 	if (!wq)
 		return NULL;
 
-	INIT_LIST_HEAD(&wq->list);
+	pthread_mutex_init(&wq->lock, NULL);
 	INIT_LIST_HEAD(&wq->pending_work);
+	INIT_LIST_HEAD(&wq->workers);
 
+	pthread_cond_init(&wq->more_work, NULL);
 	pthread_cond_init(&wq->work_finished, NULL);
 
 	va_start(args, max_active);
 	vsnprintf(wq->name, sizeof(wq->name), fmt, args);
 	va_end(args);
 
-	wq->worker = kthread_run(worker_thread, wq, "%s", wq->name);
-	if (IS_ERR(wq->worker)) {
+	/*
+	 * Userspace threads aren't bound to a cpu, so bound and WQ_UNBOUND
+	 * workqueues both get up to one worker per cpu:
+	 */
+	if (!max_active)
+		max_active = WQ_DFL_ACTIVE;
+	wq->max_workers = clamp_t(long, max_active, 1, max(nr_cpus, 1L));
+
+	pthread_mutex_lock(&wq->lock);
+	start_worker(wq);
+	pthread_mutex_unlock(&wq->lock);
+
+	if (!wq->nr_workers) {
 		kfree(wq);
 		return NULL;
 	}
 
-	pthread_mutex_lock(&wq_lock);
-	list_add(&wq->list, &wq_list);
-	pthread_mutex_unlock(&wq_lock);
-
 	return wq;
 }
 
@@ -84,11 +84,16 @@ void qcow2_write_image(int infd, int outfd, ranges *data,
 		.offset		= round_up(sizeof(hdr), block_size),
 	};
 	struct range *r;
-	char *buf = xmalloc(block_size);
+	char *buf;
 	u64 src_offset, dst_offset;
 
 	assert(is_power_of_2(block_size));
 
+	/* aligned, so that infd can be opened with O_DIRECT: */
+	buf = aligned_alloc(block_size, block_size);
+	if (!buf)
+		die("insufficient memory");
+
 	ranges_roundup(data, block_size);
 	ranges_sort_merge(data);
 
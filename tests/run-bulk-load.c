@@ -0,0 +1,155 @@
+/*
+ * Bulk loads the extents btree of a scratch filesystem, then checks that
+ * iterating over it returns every key, in order - links against the rest of
+ * libbcache and the tools library.
+ */
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tap.h"
+
+#include "libbcache.h"
+#include "bcache.h"
+#include "btree_gc.h"
+#include "btree_iter.h"
+#include "btree_update.h"
+#include "buckets.h"
+#include "super.h"
+
+#define NR_KEYS		100000
+
+/* One sector reservations, with a hole between each: */
+static u64 key_end(u64 i)
+{
+	return i * 2 + 1;
+}
+
+static int add_key(struct btree_bulk_load *l, u64 i)
+{
+	struct bch_fs *c = l->c;
+	struct bkey_i_reservation r;
+	struct disk_reservation res;
+	int ret;
+
+	bkey_reservation_init(&r.k_i);
+	r.k.p		= POS(BCACHE_ROOT_INO, key_end(i));
+	r.k.size	= 1;
+	r.v.nr_replicas	= 1;
+
+	ret = bch_disk_reservation_get(c, &res, r.k.size, 0);
+	if (ret)
+		return ret;
+
+	ret = bch_btree_bulk_load_add(l, &r.k_i, &res);
+	bch_disk_reservation_put(c, &res);
+	return ret;
+}
+
+/* The same key, inserted the normal way: */
+static int insert_key(struct bch_fs *c, u64 i)
+{
+	struct bkey_i_reservation r;
+	struct disk_reservation res;
+	int ret;
+
+	bkey_reservation_init(&r.k_i);
+	r.k.p		= POS(BCACHE_ROOT_INO, key_end(i));
+	r.k.size	= 1;
+	r.v.nr_replicas	= 1;
+
+	ret = bch_disk_reservation_get(c, &res, r.k.size, 0);
+	if (ret)
+		return ret;
+
+	ret = bch_btree_insert(c, BTREE_ID_EXTENTS, &r.k_i, &res,
+			       NULL, NULL, 0);
+	bch_disk_reservation_put(c, &res);
+	return ret;
+}
+
+static u64 nr_extents(struct bch_fs *c, bool *sorted)
+{
+	struct btree_iter iter;
+	struct bkey_s_c k;
+	u64 nr = 0;
+
+	*sorted = true;
+
+	for_each_btree_key(&iter, c, BTREE_ID_EXTENTS, POS_MIN, k)
+		*sorted &= k.k->p.offset == key_end(nr++);
+	bch_btree_iter_unlock(&iter);
+
+	return nr;
+}
+
+int main(void)
+{
+	char path[] = "/tmp/run-bulk-load.XXXXXX";
+	char *paths[1] = { path };
+	struct dev_opts dev = { .path = path };
+	struct btree_bulk_load l;
+	struct bch_fs *c;
+	u64 i, reserved;
+	bool sorted;
+	int ret = 0;
+
+	plan_tests(12);
+
+	dev.fd = mkstemp(path);
+	if (dev.fd < 0 || ftruncate(dev.fd, 256 << 20))
+		die("error creating %s: %m", path);
+
+	free(bcache_format(format_opts_default(), &dev, 1));
+	close(dev.fd);
+
+	if (bch_fs_open(paths, 1, bch_opts_empty(), &c))
+		die("error opening %s", path);
+
+	reserved = bch_fs_usage_read(c).persistent_reserved;
+
+	/* An out of order key is rejected, and tears down the load: */
+	ok1(!bch_btree_bulk_load_init(&l, c, BTREE_ID_EXTENTS, 1));
+
+	for (i = 0; i < 1000 && !ret; i++)
+		ret = add_key(&l, i);
+	ok1(!ret && add_key(&l, 0) == -EINVAL);
+
+	ok1(!nr_extents(c, &sorted) &&
+	    bch_fs_usage_read(c).persistent_reserved == reserved);
+
+	/* So is a load that something else inserted into behind its back: */
+	ok1(!bch_btree_bulk_load_init(&l, c, BTREE_ID_EXTENTS, 1));
+
+	for (i = 0; i < 1000 && !ret; i++)
+		ret = add_key(&l, i);
+	ok1(!ret && !insert_key(c, 1000) &&
+	    bch_btree_bulk_load_finish(&l) == -EEXIST);
+
+	ok1(nr_extents(c, &sorted) == 1 &&
+	    bch_fs_usage_read(c).persistent_reserved == reserved + 1);
+
+	ok1(!bch_btree_delete_range(c, BTREE_ID_EXTENTS, POS_MIN, POS_MAX,
+				    ZERO_VERSION, NULL, NULL, NULL) &&
+	    !nr_extents(c, &sorted));
+
+	/* gc running in the middle of a load mustn't lose its marks: */
+	ok1(!bch_btree_bulk_load_init(&l, c, BTREE_ID_EXTENTS, 1));
+
+	for (i = 0; i < NR_KEYS && !ret; i++) {
+		ret = add_key(&l, i);
+		if (i == NR_KEYS / 2)
+			bch_gc(c);
+	}
+	ok1(!ret && bch_fs_usage_read(c).persistent_reserved ==
+	    reserved + NR_KEYS);
+
+	ok1(!bch_btree_bulk_load_finish(&l));
+	ok1(c->btree_roots[BTREE_ID_EXTENTS].b->level > 0);
+
+	ok1(nr_extents(c, &sorted) == NR_KEYS && sorted);
+
+	bch_fs_stop(c);
+	unlink(path);
+
+	return exit_status();
+}
@@ -0,0 +1,79 @@
+#include "../linux/crc64.c"
+
+#include <stdlib.h>
+
+#include "tap.h"
+
+#define BUF_SIZE	(64 * 1024 + 256)
+
+/* One bit at a time, straight from the polynomial: */
+static u64 crc64_be_bitwise(u64 crc, const u8 *p, size_t len)
+{
+	unsigned i;
+
+	while (len--) {
+		crc ^= (u64) *p++ << 56;
+
+		for (i = 0; i < 8; i++)
+			crc = (crc << 1) ^ ((crc >> 63) ? crc64_table[0][1] : 0);
+	}
+
+	return crc;
+}
+
+static unsigned check(u64 (*fn)(u64, const u8 *, size_t), const u8 *buf)
+{
+	unsigned i, bad = 0;
+
+	/* Every small length and alignment: */
+	for (i = 0; i < 64 * 256; i++)
+		if (fn(i, buf + i % 64, i / 64) !=
+		    crc64_be_bitwise(i, buf + i % 64, i / 64))
+			bad++;
+
+	/* Random lengths, alignments and initial crcs: */
+	for (i = 0; i < 1000; i++) {
+		size_t off = random() % 64;
+		size_t len = random() % (BUF_SIZE - 64);
+		u64 crc = ((u64) random() << 32) ^ random();
+
+		if (fn(crc, buf + off, len) !=
+		    crc64_be_bitwise(crc, buf + off, len))
+			bad++;
+	}
+
+	return bad;
+}
+
+/* crc64_be() may use the PCLMUL path: every path must agree with the bitwise crc. */
+int main(int argc, char *argv[])
+{
+	u8 *buf = malloc(BUF_SIZE);
+	unsigned i;
+
+	plan_tests(4);
+
+	srandom(1);
+	for (i = 0; i < BUF_SIZE; i++)
+		buf[i] = random();
+
+	ok1(!check(crc64_be_slice8, buf));
+#ifdef __x86_64__
+	if (crc64_be_fn == crc64_be_pclmul)
+		ok1(!check(crc64_be_pclmul, buf));
+	else
+		skip(1, "no PCLMUL");
+#else
+	skip(1, "no PCLMUL");
+#endif
+	ok1(!check(crc64_be_fn, buf));
+
+	/* Combining the crcs of two parts: */
+	ok1(crc64_be_combine(crc64_be(~0ULL, buf, 12345),
+			     crc64_be(0, buf + 12345, BUF_SIZE - 12345),
+			     BUF_SIZE - 12345) ==
+	    crc64_be_bitwise(~0ULL, buf, BUF_SIZE));
+
+	free(buf);
+	return exit_status();
+}
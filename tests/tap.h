@@ -0,0 +1,55 @@
+#ifndef _TESTS_TAP_H
+#define _TESTS_TAP_H
+
+/*
+ * Just enough of the Test Anything Protocol for the tests in this directory -
+ * the same interface as ccan/tap, which we don't carry:
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static unsigned tap_planned, tap_run, tap_failed;
+
+static inline void plan_tests(unsigned nr)
+{
+	tap_planned = nr;
+	printf("1..%u\n", nr);
+}
+
+static inline int __ok(int pass, const char *expr, const char *file,
+		       unsigned line)
+{
+	tap_run++;
+
+	if (pass) {
+		printf("ok %u - %s\n", tap_run, expr);
+	} else {
+		tap_failed++;
+		printf("not ok %u - %s\n"
+		       "#     Failed test (%s:%u)\n",
+		       tap_run, expr, file, line);
+	}
+
+	return pass;
+}
+
+#define ok1(e)		__ok(!!(e), #e, __FILE__, __LINE__)
+
+static inline void skip(unsigned nr, const char *why)
+{
+	while (nr--)
+		printf("ok %u # skip %s\n", ++tap_run, why);
+}
+
+static inline int exit_status(void)
+{
+	if (tap_run != tap_planned) {
+		printf("# Planned %u tests but ran %u\n", tap_planned, tap_run);
+		return EXIT_FAILURE;
+	}
+
+	return tap_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif /* _TESTS_TAP_H */